@@ -92,8 +92,6 @@ using namespace ReNes;
         
 //        @autoreleasepool {
         
-            NSData* data = [NSData dataWithContentsOfFile:filePath];
-            
             if (_nes != 0)
             {
                 delete _nes;
@@ -154,7 +152,21 @@ using namespace ReNes;
             //        });
             
             _nes->setDebug(false);
-            _nes->loadRom((const uint8_t*)[data bytes], [data length]);
+            
+            // 文件打不开、格式错误或者不支持该mapper
+            if (!_nes->loadRomFile([filePath fileSystemRepresentation]))
+            {
+                NSLog(@"无法加载ROM %@", filePath);
+                
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    
+                    NSAlert* alert = [[NSAlert alloc] init];
+                    alert.messageText = @"无法加载ROM";
+                    alert.informativeText = filePath;
+                    [alert runModal];
+                });
+                return;
+            }
             
             _nes->run();
             
@@ -249,17 +261,22 @@ using namespace ReNes;
             int count;
             NSTextView* dstView;
             const uint8_t* srcData;
+            std::vector<uint8_t> dumped; // 按页表导出的内存，切换bank之后仍然是CPU/PPU看到的内容
             
             switch ([[_memTabView.selectedTabViewItem identifier] integerValue]) {
                 case 0:
                     dstView = _memView;
                     count = 0x10000;
-                    srcData = _nes->mem()->masterData();
+                    dumped.resize(Memory::DEFUALT_SIZE);
+                    _nes->mem()->dump(dumped.data());
+                    srcData = dumped.data();
                     break;
                 case 1:
                     dstView = _vramView;
                     count = 1024*16;
-                    srcData = const_cast<VRAM*>(_nes->ppu()->vram())->masterData();
+                    dumped.resize(VRAM::DEFUALT_SIZE);
+                    _nes->ppu()->vram()->dump(dumped.data());
+                    srcData = dumped.data();
                     break;
                     
                 case 2:
@@ -357,36 +374,20 @@ using namespace ReNes;
     uint8_t cmd;
     
     std::string dis;
+    dis.reserve(1024*32*8);
+    
+    Memory* mem = _nes->mem();
+    
     do {
         
-        Memory* mem = _nes->mem();
-        
         // 从内存里面取出一条8bit指令，将PC移动到下一个内存地址
         cmd = mem->get8bitData(pc);
         
-        //    log("[%ld][%04X] cmd: %x => ", execCmdLine, pc, cmd);
-        
-        if (!RENES_SET_FIND(CMD_LIST, cmd))
-        {
-//            assert(!"未知的指令！");
-//            log("[%04X] cmd: %x => ", pc, cmd);
-//            break;
-            
-            std::string str = std::to_string(cmd);
-            str = "[" + int_to_hex(pc) + "]\t\t" + str + "\n";
-            dis += str;
-            pc ++;
-        }
-        else
-        {
-            auto info = CMD_LIST.at(cmd);
-            std::string str = cmd_str(info, pc, mem);
-            str = "[" + int_to_hex(pc) + "]\t\t" + str + "\n";
-            //        printf("%s", str.c_str());
-            
-            dis += str;
-            pc += info.bytes;
-        }
+        int bytes;
+        char str[CMD_STR_MAX + 16];
+        size_t length = cmd_disassemble(str, sizeof(str), pc, mem, &bytes);
+        dis.append(str, length);
+        pc += bytes;
         
         if (cmd == 0) // brk 下一句地址+1
         {
@@ -444,6 +445,7 @@ using namespace ReNes;
         @autoreleasepool {
         
             const CPU::__registers& regs = _nes->cpu()->regs;
+            const bit8 P = _nes->cpu()->status();
             
             const bool* statues = _nes->ctr()->statues();
             
@@ -454,14 +456,14 @@ C:%d Z:%d I:%d D:%d B:%d _:%d V:%d N:%d\n\
 A:%d X:%d Y:%d - %.9lf(%.9lf), %lf - fps %d\n\
 %d %d %d %d %d %d %d %d\n\
 %s", regs.PC, regs.SP,
-                                          regs.P.get(CPU::__registers::C),
-                                          regs.P.get(CPU::__registers::Z),
-                                          regs.P.get(CPU::__registers::I),
-                                          regs.P.get(CPU::__registers::D),
-                                          regs.P.get(CPU::__registers::B),
-                                          regs.P.get(CPU::__registers::_),
-                                          regs.P.get(CPU::__registers::V),
-                                          regs.P.get(CPU::__registers::N),
+                                          P.get(CPU::__registers::C),
+                                          P.get(CPU::__registers::Z),
+                                          P.get(CPU::__registers::I),
+                                          P.get(CPU::__registers::D),
+                                          P.get(CPU::__registers::B),
+                                          P.get(CPU::__registers::_),
+                                          P.get(CPU::__registers::V),
+                                          P.get(CPU::__registers::N),
                                           regs.A,regs.X,regs.Y,
                                           (double)_nes->cpuCycleTime() / 1e9, (double)572 / 1e9, perFrameTime, (int)(1.0 / perFrameTime),
                                           statues[0], statues[1], statues[2], statues[3], statues[4], statues[5], statues[6], statues[7],
@@ -0,0 +1,74 @@
+//
+//  main.cpp
+//  RENES_AOT
+//
+//  预编译工具：把ROM中的6502代码转换为C++代码
+//
+//  编译（在项目根目录）:
+//      c++ -std=gnu++11 -O2 -I. RENES_AOT/main.cpp -o renes_aot -lpthread
+//
+//  用法: renes_aot <rom.nes> <output.cpp> [name]
+//      name 是生成代码中使用的名字（需要是合法的标识符），默认为 rom。只支持PRG ROM不能切换bank的卡带
+//
+//  生成的文件和使用模拟器的程序一起编译（头文件搜索路径包含项目根目录），例如:
+//      c++ -std=gnu++11 -O2 -I. app.cpp mario_aot.cpp -o app -lpthread
+//  文件中的全局变量 AotRegistrar 在程序启动时把预编译结果按PRG ROM的CRC32加入 AotRegistry，
+//  Nes::loadRom 加载CRC32相同的ROM时自动使用。需要直接链接生成的 .o，放进静态库时链接器会丢掉没有被引用的注册变量。
+//  运行前把 CPU::interpreter 设置为 INTERPRETER_AOT，Nes::execMode 设置为 EXEC_MODE_BLOCK 后生效，
+//  没有预编译的代码仍然由解释器执行
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <src/renes.hpp>
+
+using namespace ReNes;
+
+int main(int argc, const char * argv[]) {
+    
+    if (argc < 3)
+    {
+        printf("用法: %s <rom.nes> <output.cpp> [name]\n", argv[0]);
+        return 1;
+    }
+    
+    std::string name = argc > 3 ? argv[3] : "rom";
+    
+    // ROM文件以只读方式映射，不需要读入内存
+    Nes nes;
+    if (!nes.loadRomFile(argv[1]))
+    {
+        printf("无法加载ROM %s\n", argv[1]);
+        return 1;
+    }
+    
+    // 运行时切换PRG ROM bank的卡带不使用预编译代码
+    if (nes.mem()->prgSwitchable())
+    {
+        printf("PRG ROM可以切换bank，不支持预编译 %s\n", argv[1]);
+        return 1;
+    }
+    
+    AotRecompiler recompiler(nes.mem());
+    recompiler.discover();
+    
+    std::string code = recompiler.generate(name.c_str(), nes.prgCrc());
+    
+    FILE* output = fopen(argv[2], "wb");
+    if (!output)
+    {
+        printf("无法写入 %s\n", argv[2]);
+        return 1;
+    }
+    fwrite(code.data(), 1, code.size(), output);
+    fclose(output);
+    
+    printf("%s: %zu 个基本块 -> %s\n", name.c_str(), recompiler.blockCount(), argv[2]);
+    
+    return 0;
+}
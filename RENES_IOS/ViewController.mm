@@ -91,8 +91,6 @@ using namespace ReNes;
         
         @autoreleasepool {
             
-            NSData* data = [NSData dataWithContentsOfFile:filePath];
-            
             if (_nes != 0)
             {
                 delete _nes;
@@ -105,29 +103,8 @@ using namespace ReNes;
 //                [self disassembly];
             };
             
-            _nes->cpu_callback = [self](CPU* cpu){
-                
-                // 手动中断
-                //            @synchronized ((__bridge id)_nes)
-                {
-//                    if (cpu == _nes->cpu())
-//                    {
-//                        if (!_keepNext)
-//                        {
-//                            dispatch_semaphore_wait(_nextSem, DISPATCH_TIME_FOREVER);
-//                        }
-//                        else if ((cpu->regs.PC == _stopedCmdAddr || cpu->execCmdLine == _stopedCmdLine))
-//                        {
-//                            _nes->setDebug(true);
-//                            log("自定义地址中断\n");
-//                            dispatch_semaphore_wait(_nextSem, DISPATCH_TIME_FOREVER);
-//                        }
-//                    }
-                }
-                
-                
-                return true;
-            };
+            // 不调试的时候不设置 cpu_callback，避免每条指令的回调开销，并按基本块执行指令
+            _nes->execMode = Nes::EXEC_MODE_BLOCK;
             
             _nes->ppu_displayCallback = [self](PPU* ppu){
                 
@@ -170,7 +147,20 @@ using namespace ReNes;
             //        });
             
             _nes->setDebug(false);
-            _nes->loadRom((const uint8_t*)[data bytes], [data length]);
+            
+            // 文件打不开、格式错误或者不支持该mapper
+            if (!_nes->loadRomFile([filePath fileSystemRepresentation]))
+            {
+                NSLog(@"无法加载ROM %@", filePath);
+                
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    
+                    UIAlertController* alert = [UIAlertController alertControllerWithTitle:@"无法加载ROM" message:filePath preferredStyle:UIAlertControllerStyleAlert];
+                    [alert addAction:[UIAlertAction actionWithTitle:@"确定" style:UIAlertActionStyleDefault handler:nil]];
+                    [self presentViewController:alert animated:YES completion:nil];
+                });
+                return;
+            }
             
             _nes->run();
             
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include "type.hpp"
+#include "mem.hpp"
+#include "cpu.hpp"
+
+namespace ReNes {
+    
+    // 预编译（AOT）：从复位、NMI、IRQ中断向量开始递归下降，找到PRG ROM中的所有基本块，
+    // 每个基本块生成一个C++函数，编译进程序后按PRG ROM的CRC32注册，loadRom 时自动匹配。
+    // 生成的函数与 Jit::NativeBlock 的调用方式、周期计算完全一致，没有找到的代码在运行时交给 JIT / 解释器
+    
+    // 一个ROM的预编译结果
+    struct AotProgram {
+        const char* name;
+        uint32_t prgCrc;                            // PRG ROM数据的CRC32
+        const CPU::PrecompiledBlock* blocks;
+        int count;
+    };
+    
+    // 预编译结果的注册表
+    class AotRegistry {
+    
+    public:
+        
+        static void add(const AotProgram* program)
+        {
+            _programs().push_back(program);
+        }
+        
+        static const AotProgram* find(uint32_t prgCrc)
+        {
+            for (const AotProgram* program : _programs())
+            {
+                if (program->prgCrc == prgCrc)
+                    return program;
+            }
+            return 0;
+        }
+    
+    private:
+        
+        static std::vector<const AotProgram*>& _programs()
+        {
+            static std::vector<const AotProgram*> programs;
+            return programs;
+        }
+    };
+    
+    // 在生成的代码中定义全局变量，程序启动时注册
+    struct AotRegistrar {
+        
+        AotRegistrar(const AotProgram* program)
+        {
+            AotRegistry::add(program);
+        }
+    };
+    
+    // 生成的代码通过这里调用特化的指令处理函数，编译器可以把整个基本块展开成直线代码
+    struct AotRuntime {
+        
+        template <uint8_t OP>
+        static RENES_FORCE_INLINE
+        void exec(CPU* cpu, uint16_t oper)
+        {
+            cpu->_execSpecialized<CMD_LIST[OP].cf, CMD_LIST[OP].mode, CMD_LIST[OP].bytes>(oper);
+        }
+        
+        static inline
+        uint16_t pc(const CPU* cpu)
+        {
+            return cpu->regs.PC;
+        }
+    };
+    
+    // 生成的代码中使用的宏，与 Jit::compile 生成的代码逻辑相同
+#define RENES_AOT_BLOCK_BEGIN ReNes::CPU* cpu = (ReNes::CPU*)c; int n = 0; do {
+#define RENES_AOT_CMD(op, oper, cmdCycles) ReNes::AotRuntime::exec<op>(cpu, oper); *cycles += cmdCycles; n++; if (*cycles >= budget) return n;
+#define RENES_AOT_BLOCK_END(start) } while (ReNes::AotRuntime::pc(cpu) == start); return n;
+    
+    // 预编译器，生成C++代码
+    class AotRecompiler {
+    
+    public:
+        
+        // 每个基本块最多的指令条数，与JIT一致
+        const static int BLOCK_CMD_MAX = Jit::BLOCK_CMD_MAX;
+        
+        // mem 中需要已经载入PRG ROM
+        AotRecompiler(const Memory* mem)
+        :_mem(mem)
+        {
+        }
+        
+        // 从中断向量开始查找所有基本块
+        void discover()
+        {
+            const uint16_t vectors[] = {0xFFFA, 0xFFFC, 0xFFFE};
+            for (uint16_t v : vectors)
+            {
+                uint16_t addr = _mem->get16bitData(v);
+                
+                // 与 CPU::process_interrupts 一致
+                if (addr == 0)
+                    addr = PRG_ROM_LOWER_BANK_OFFSET;
+                
+                _addBlock(addr);
+            }
+            
+            while (!_pending.empty())
+            {
+                uint16_t pc = _pending.back();
+                _pending.pop_back();
+                
+                _discoverBlock(pc);
+            }
+        }
+        
+        // 找到的基本块数
+        inline size_t blockCount() const
+        {
+            return _blocks.size();
+        }
+        
+        // 生成C++代码，name 需要是合法的标识符
+        std::string generate(const char* name, uint32_t prgCrc) const
+        {
+            std::string code;
+            char line[256];
+            
+            snprintf(line, sizeof(line),
+                     "// 由 RENES_AOT 生成，不要手动修改\n"
+                     "// %s PRG CRC32: %08X 基本块: %zu\n\n"
+                     "#include <stdio.h>\n"
+                     "#include <string.h>\n"
+                     "#include <stdarg.h>\n"
+                     "#include <assert.h>\n"
+                     "#include <math.h>\n"
+                     "#include <src/aot.hpp>\n\n"
+                     "namespace {\n\n",
+                     name, prgCrc, _blocks.size());
+            code += line;
+            
+            for (uint16_t pc : _blocks)
+            {
+                snprintf(line, sizeof(line), "    int block_%04X(void* c, int* cycles, int budget)\n    {\n        RENES_AOT_BLOCK_BEGIN\n", pc);
+                code += line;
+                
+                int cur = pc;
+                for (int i=0; i<BLOCK_CMD_MAX; i++)
+                {
+                    if (!_cmdInRom(cur))
+                        break;
+                    
+                    uint8_t cmd = _mem->get8bitData(cur);
+                    const CmdInfo& info = CMD_LIST[cmd];
+                    
+                    uint16_t oper = info.bytes == 3 ? _mem->get16bitData(cur + 1) : (info.bytes == 2 ? _mem->get8bitData(cur + 1) : 0);
+                    
+                    snprintf(line, sizeof(line), "        /* %04X %s */ RENES_AOT_CMD(0x%02X, 0x%04X, %d)\n", cur, info.name, cmd, oper, info.cycles);
+                    code += line;
+                    
+                    if (cmd_ends_block(info.cf))
+                        break;
+                    
+                    cur += info.bytes;
+                }
+                
+                snprintf(line, sizeof(line), "        RENES_AOT_BLOCK_END(0x%04X)\n    }\n\n", pc);
+                code += line;
+            }
+            
+            code += "    const ReNes::CPU::PrecompiledBlock blocks[] = {\n";
+            for (uint16_t pc : _blocks)
+            {
+                snprintf(line, sizeof(line), "        {0x%04X, &block_%04X},\n", pc, pc);
+                code += line;
+            }
+            code += "    };\n\n";
+            
+            snprintf(line, sizeof(line),
+                     "    const ReNes::AotProgram program = {\"%s\", 0x%08X, blocks, sizeof(blocks)/sizeof(*blocks)};\n\n"
+                     "    ReNes::AotRegistrar registrar(&program);\n"
+                     "}\n",
+                     name, prgCrc);
+            code += line;
+            
+            return code;
+        }
+    
+    private:
+        
+        // pc处是否是完整位于PRG ROM中的已定义指令
+        inline bool _cmdInRom(int pc) const
+        {
+            if (pc < PRG_ROM_LOWER_BANK_OFFSET || pc > 0xFFFF)
+                return false;
+            
+            uint8_t cmd = _mem->get8bitData(pc);
+            return cmd_defined(cmd) && pc + CMD_LIST[cmd].bytes - 1 <= 0xFFFF;
+        }
+        
+        void _addBlock(int pc)
+        {
+            // RAM中的代码不预编译
+            if (!_cmdInRom(pc))
+                return;
+            
+            if (_blocks.insert(pc).second)
+                _pending.push_back(pc);
+        }
+        
+        // 沿着基本块执行路径查找，把跳转目标加入待查找的基本块
+        void _discoverBlock(uint16_t pc)
+        {
+            int cur = pc;
+            for (int i=0; i<BLOCK_CMD_MAX; i++)
+            {
+                if (!_cmdInRom(cur))
+                    return;
+                
+                uint8_t cmd = _mem->get8bitData(cur);
+                const CmdInfo& info = CMD_LIST[cmd];
+                int next = cur + info.bytes;
+                
+                switch (info.cf)
+                {
+                    case CF_BCC: case CF_BCS: case CF_BEQ: case CF_BMI:
+                    case CF_BNE: case CF_BPL: case CF_BVC: case CF_BVS:
+                    {
+                        int8_t offset = (int8_t)_mem->get8bitData(cur + 1);
+                        _addBlock((uint16_t)(next + offset));
+                        _addBlock(next);
+                        return;
+                    }
+                    case CF_JMP:
+                    {
+                        // 间接跳转的目标在运行时才能确定
+                        if (info.mode == INDEXED_ABSOLUTE)
+                            _addBlock(_mem->get16bitData(cur + 1));
+                        return;
+                    }
+                    case CF_JSR:
+                    {
+                        _addBlock(_mem->get16bitData(cur + 1));
+                        _addBlock(next);
+                        return;
+                    }
+                    case CF_RTS:
+                    case CF_RTI:
+                    case CF_BRK:
+                        return;
+                    default:
+                        break;
+                }
+                
+                // CLI、SEI、PLP 结束基本块，但是继续执行下一条指令
+                if (cmd_ends_block(info.cf))
+                {
+                    _addBlock(next);
+                    return;
+                }
+                
+                cur = next;
+            }
+            
+            // 超过最大长度，剩余的指令作为新的基本块
+            _addBlock(cur);
+        }
+        
+        const Memory* _mem;
+        
+        std::set<uint16_t> _blocks;     // 所有基本块的起始地址
+        std::vector<uint16_t> _pending; // 待查找的基本块
+    };
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "type.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RENES_COMPOSE_X86
+#include <immintrin.h>
+#endif
+
+namespace ReNes {
+    
+    // 扫描线像素合成：按优先级选择背景或精灵像素，查调色板得到系统调色板颜色索引 [0,63]，再写入RGB。
+    // bk 是每像素1字节的背景调色板下标 [0,15]（见 PPU::_scrollBuffer），
+    // spr 是精灵数据（见 PPU::_prepareSprites，低4bit是精灵调色板下标，第4bit为1表示在背景后面，0表示没有精灵），
+    // 背景和精灵都不绘制的像素，显示缓冲区保持原来的颜色。
+    // 每种显示背景、精灵的组合各有一份特化的实现，只显示背景时不读取精灵数据。
+    // SSE2、AVX2 版本每次选择16、32个像素，调色板用比较或字节重排（pshufb）查表，结果与逐像素版本完全一致。
+    // AVX2 版本的系统调色板查表和RGB交错也用字节重排完成，每32个像素写入96字节
+    class Compose {
+    
+    public:
+        
+        enum Kernel {
+            KERNEL_SCALAR,  // 逐像素
+            KERNEL_SSE2,    // 16像素，仅x86
+            KERNEL_AVX2,    // 32像素，仅x86，需要CPU支持AVX2
+        };
+        
+        // 当前CPU支持的最快版本
+        static Kernel bestKernel()
+        {
+#ifdef RENES_COMPOSE_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return KERNEL_AVX2;
+            if (__builtin_cpu_supports("sse2"))
+                return KERNEL_SSE2;
+#endif
+            return KERNEL_SCALAR;
+        }
+        
+        // 合成 count 个像素写入RGB缓冲区 rgb，bkPalette、sprPalette 各16字节，systemPalette 是系统调色板（64种颜色的RGB）
+        // showSpr 为false时不读取 spr
+        static inline void scanline(Kernel kernel, uint8_t* rgb, const uint8_t* bk, const uint8_t* spr, int count,
+                                    const uint8_t* bkPalette, const uint8_t* sprPalette, const uint8_t* systemPalette, bool showBg, bool showSpr)
+        {
+            if (showBg && showSpr)
+                _scanline<true, true>(kernel, rgb, bk, spr, count, bkPalette, sprPalette, systemPalette);
+            else if (showBg)
+                _scanline<true, false>(kernel, rgb, bk, spr, count, bkPalette, sprPalette, systemPalette);
+            else if (showSpr)
+                _scanline<false, true>(kernel, rgb, bk, spr, count, bkPalette, sprPalette, systemPalette);
+            
+            // 都不显示时不绘制
+        }
+    
+    private:
+        
+        // 不绘制的像素
+        const static uint8_t NONE = 0xFF;
+        
+        template <bool SHOW_BG, bool SHOW_SPR>
+        static inline void _scanline(Kernel kernel, uint8_t* rgb, const uint8_t* bk, const uint8_t* spr, int count,
+                                     const uint8_t* bkPalette, const uint8_t* sprPalette, const uint8_t* systemPalette)
+        {
+            int done = 0;
+
+#ifdef RENES_COMPOSE_X86
+            // 逐条指令同步PPU时每次只有几个像素，不足一组时直接逐像素合成
+            if (count >= 16)
+            switch (kernel)
+            {
+                case KERNEL_AVX2:
+                    done = _avx2<SHOW_BG, SHOW_SPR>(rgb, bk, spr, count, bkPalette, sprPalette, systemPalette);
+                    break;
+                case KERNEL_SSE2:
+                    done = _sse2<SHOW_BG, SHOW_SPR>(rgb, bk, spr, count, bkPalette, sprPalette, systemPalette);
+                    break;
+                default:
+                    break;
+            }
+#endif
+            
+            // 剩余不足一组的像素
+            _scalar<SHOW_BG, SHOW_SPR>(rgb + done*3, bk + done, spr + done, count - done, bkPalette, sprPalette, systemPalette);
+        }
+        
+        static inline void _writeRGB(uint8_t* rgb, const uint8_t* colors, int count, const uint8_t* systemPalette)
+        {
+            for (int i=0; i<count; i++)
+            {
+                if (colors[i] != NONE)
+                    memcpy(&rgb[i*3], &systemPalette[colors[i]*3], 3);
+            }
+        }
+        
+        template <bool SHOW_BG, bool SHOW_SPR>
+        static inline void _scalar(uint8_t* rgb, const uint8_t* bk, const uint8_t* spr, int count,
+                                   const uint8_t* bkPalette, const uint8_t* sprPalette, const uint8_t* systemPalette)
+        {
+            for (int i=0; i<count; i++)
+            {
+                int sprData = SHOW_SPR ? spr[i] : 0;
+                int sprColor = sprData != 0 ? sprPalette[sprData & 15] : 0;
+                
+                int color;
+                if (sprColor != 0)
+                {
+                    // 精灵在背景后面，而且背景不透明
+                    bool behind = (sprData & 0x10) != 0;
+                    color = SHOW_BG && behind && bk[i] != 0 ? bkPalette[bk[i]] : sprColor;
+                }
+                else if (SHOW_BG)
+                {
+                    color = bkPalette[bk[i]];
+                }
+                else
+                {
+                    continue;
+                }
+                memcpy(&rgb[i*3], &systemPalette[color*3], 3);
+            }
+        }
+
+#ifdef RENES_COMPOSE_X86
+        
+        // SSE2没有字节重排指令，16项的表逐项比较后合并
+        __attribute__((target("sse2")))
+        static inline __m128i _lookupSse2(__m128i index, const uint8_t* table)
+        {
+            __m128i result = _mm_setzero_si128();
+            for (int k=0; k<16; k++)
+            {
+                __m128i match = _mm_cmpeq_epi8(index, _mm_set1_epi8((char)k));
+                result = _mm_or_si128(result, _mm_and_si128(match, _mm_set1_epi8((char)table[k])));
+            }
+            return result;
+        }
+        
+        __attribute__((target("sse2")))
+        static inline __m128i _selectSse2(__m128i mask, __m128i a, __m128i b)
+        {
+            return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+        }
+        
+        // 返回处理的像素数
+        template <bool SHOW_BG, bool SHOW_SPR>
+        __attribute__((target("sse2")))
+        static int _sse2(uint8_t* rgb, const uint8_t* bk, const uint8_t* spr, int count,
+                         const uint8_t* bkPalette, const uint8_t* sprPalette, const uint8_t* systemPalette)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i lowMask = _mm_set1_epi8(0x0F);
+            const __m128i behindBit = _mm_set1_epi8(0x10);
+            const __m128i none = _mm_set1_epi8((char)NONE);
+            
+            uint8_t colors[16];
+            
+            int i = 0;
+            for (; i+16<=count; i+=16)
+            {
+                __m128i bkIndex = zero;
+                __m128i result = none;
+                
+                if (SHOW_BG)
+                {
+                    bkIndex = _mm_loadu_si128((const __m128i*)(bk + i));
+                    result = _lookupSse2(bkIndex, bkPalette);
+                }
+                
+                if (SHOW_SPR)
+                {
+                    __m128i sprData = _mm_loadu_si128((const __m128i*)(spr + i));
+                    __m128i sprColor = _mm_andnot_si128(_mm_cmpeq_epi8(sprData, zero), _lookupSse2(_mm_and_si128(sprData, lowMask), sprPalette));
+                    __m128i noSpr = _mm_cmpeq_epi8(sprColor, zero); // 精灵透明的像素
+                
+                    if (SHOW_BG)
+                    {
+                        // 精灵在背景后面，而且背景不透明
+                        __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(sprData, behindBit), behindBit);
+                        __m128i bkWins = _mm_andnot_si128(_mm_cmpeq_epi8(bkIndex, zero), behind);
+                        sprColor = _selectSse2(bkWins, result, sprColor);
+                    }
+                
+                    result = _selectSse2(noSpr, result, sprColor);
+                }
+                
+                _mm_storeu_si128((__m128i*)colors, result);
+                _writeRGB(rgb + i*3, colors, 16, systemPalette);
+            }
+            return i;
+        }
+        
+        __attribute__((target("avx2")))
+        static inline __m256i _selectAvx2(__m256i mask, __m256i a, __m256i b)
+        {
+            return _mm256_blendv_epi8(b, a, mask);
+        }
+        
+        // 64项的表查找：table 是4段，每段16项（两个128bit中各一份），index 是每段对应的下标
+        __attribute__((target("avx2")))
+        static inline __m256i _lookup64Avx2(const __m256i* table, const __m256i* index)
+        {
+            __m256i a = _mm256_or_si256(_mm256_shuffle_epi8(table[0], index[0]), _mm256_shuffle_epi8(table[1], index[1]));
+            __m256i b = _mm256_or_si256(_mm256_shuffle_epi8(table[2], index[2]), _mm256_shuffle_epi8(table[3], index[3]));
+            return _mm256_or_si256(a, b);
+        }
+        
+        // R、G、B三个通道按 table 交错成16字节（两个128bit各自独立）
+        __attribute__((target("avx2")))
+        static inline __m256i _interleaveAvx2(__m256i r, __m256i g, __m256i b, const uint8_t (*table)[16])
+        {
+            __m256i a = _mm256_shuffle_epi8(r, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)table[0])));
+            a = _mm256_or_si256(a, _mm256_shuffle_epi8(g, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)table[1]))));
+            return _mm256_or_si256(a, _mm256_shuffle_epi8(b, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)table[2]))));
+        }
+        
+        // 32个系统调色板颜色索引 [0,63] 查表后交错成96字节RGB写入 rgb，planes 是按R、G、B分开、每个通道4段的系统调色板。
+        // ALL_DRAWN 为false时，NONE 的像素保持原来的颜色
+        template <bool ALL_DRAWN>
+        __attribute__((target("avx2")))
+        static inline void _writeRGB32(uint8_t* rgb, __m256i colors, const __m256i (*planes)[4])
+        {
+            // 每个128bit的16个像素交错成48字节，分成3个16字节，每个字节来自哪个像素的哪个通道（0x80表示不是这个通道）
+            alignas(16) static const uint8_t INTERLEAVE[3][3][16] = {
+                {
+                    {0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80, 0x05},
+                    {0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80},
+                    {0x80, 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80},
+                },
+                {
+                    {0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0A, 0x80},
+                    {0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0A},
+                    {0x80, 0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80},
+                },
+                {
+                    {0x80, 0x0B, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x0F, 0x80, 0x80},
+                    {0x80, 0x80, 0x0B, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x0F, 0x80},
+                    {0x0A, 0x80, 0x80, 0x0B, 0x80, 0x80, 0x0C, 0x80, 0x80, 0x0D, 0x80, 0x80, 0x0E, 0x80, 0x80, 0x0F},
+                },
+            };
+            
+            // 3个16字节中每个字节属于哪个像素
+            alignas(16) static const uint8_t REPEAT[3][16] = {
+                {0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5},
+                {5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10},
+                {10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15},
+            };
+            
+            // 颜色在第k段时 colors ^ (k<<4) 是 [0,15]，加上0x70之后最高位为0；不在这一段时（包括 NONE）最高位为1，pshufb 得到0
+            const __m256i bias = _mm256_set1_epi8(0x70);
+            __m256i index[4] = {
+                _mm256_adds_epu8(colors, bias),
+                _mm256_adds_epu8(_mm256_xor_si256(colors, _mm256_set1_epi8(0x10)), bias),
+                _mm256_adds_epu8(_mm256_xor_si256(colors, _mm256_set1_epi8(0x20)), bias),
+                _mm256_adds_epu8(_mm256_xor_si256(colors, _mm256_set1_epi8(0x30)), bias),
+            };
+            
+            __m256i r = _lookup64Avx2(planes[0], index);
+            __m256i g = _lookup64Avx2(planes[1], index);
+            __m256i b = _lookup64Avx2(planes[2], index);
+            
+            __m256i out0 = _interleaveAvx2(r, g, b, INTERLEAVE[0]);
+            __m256i out1 = _interleaveAvx2(r, g, b, INTERLEAVE[1]);
+            __m256i out2 = _interleaveAvx2(r, g, b, INTERLEAVE[2]);
+            
+            // 低128bit是前16个像素的48字节，高128bit是后16个像素的
+            __m256i store0 = _mm256_permute2x128_si256(out0, out1, 0x20);
+            __m256i store1 = _mm256_permute2x128_si256(out2, out0, 0x30);
+            __m256i store2 = _mm256_permute2x128_si256(out1, out2, 0x31);
+            
+            __m256i* dst = (__m256i*)rgb;
+            if (!ALL_DRAWN)
+            {
+                __m256i none = _mm256_cmpeq_epi8(colors, _mm256_set1_epi8((char)NONE));
+                __m256i mask0 = _mm256_shuffle_epi8(none, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)REPEAT[0])));
+                __m256i mask1 = _mm256_shuffle_epi8(none, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)REPEAT[1])));
+                __m256i mask2 = _mm256_shuffle_epi8(none, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)REPEAT[2])));
+                
+                store0 = _mm256_blendv_epi8(store0, _mm256_loadu_si256(dst), _mm256_permute2x128_si256(mask0, mask1, 0x20));
+                store1 = _mm256_blendv_epi8(store1, _mm256_loadu_si256(dst + 1), _mm256_permute2x128_si256(mask2, mask0, 0x30));
+                store2 = _mm256_blendv_epi8(store2, _mm256_loadu_si256(dst + 2), _mm256_permute2x128_si256(mask1, mask2, 0x31));
+            }
+            
+            _mm256_storeu_si256(dst, store0);
+            _mm256_storeu_si256(dst + 1, store1);
+            _mm256_storeu_si256(dst + 2, store2);
+        }
+        
+        // 返回处理的像素数
+        template <bool SHOW_BG, bool SHOW_SPR>
+        __attribute__((target("avx2")))
+        static int _avx2(uint8_t* rgb, const uint8_t* bk, const uint8_t* spr, int count,
+                         const uint8_t* bkPalette, const uint8_t* sprPalette, const uint8_t* systemPalette)
+        {
+            // pshufb 只在128bit内重排，两半使用同一张表
+            const __m256i bkTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)bkPalette));
+            const __m256i sprTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)sprPalette));
+            
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i lowMask = _mm256_set1_epi8(0x0F);
+            const __m256i behindBit = _mm256_set1_epi8(0x10);
+            const __m256i none = _mm256_set1_epi8((char)NONE);
+            
+            // 系统调色板按R、G、B分开
+            alignas(16) uint8_t channels[3][64];
+            for (int c=0; c<64; c++)
+            {
+                channels[0][c] = systemPalette[c*3];
+                channels[1][c] = systemPalette[c*3 + 1];
+                channels[2][c] = systemPalette[c*3 + 2];
+            }
+            
+            __m256i planes[3][4];
+            for (int c=0; c<3; c++)
+            {
+                for (int k=0; k<4; k++)
+                    planes[c][k] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)&channels[c][k*16]));
+            }
+            
+            int i = 0;
+            for (; i+32<=count; i+=32)
+            {
+                __m256i bkIndex = zero;
+                __m256i result = none;
+                
+                if (SHOW_BG)
+                {
+                    bkIndex = _mm256_loadu_si256((const __m256i*)(bk + i));
+                    result = _mm256_shuffle_epi8(bkTable, _mm256_and_si256(bkIndex, lowMask));
+                }
+                
+                if (SHOW_SPR)
+                {
+                    __m256i sprData = _mm256_loadu_si256((const __m256i*)(spr + i));
+                    __m256i sprColor = _mm256_andnot_si256(_mm256_cmpeq_epi8(sprData, zero), _mm256_shuffle_epi8(sprTable, _mm256_and_si256(sprData, lowMask)));
+                    __m256i noSpr = _mm256_cmpeq_epi8(sprColor, zero); // 精灵透明的像素
+                
+                    if (SHOW_BG)
+                    {
+                        // 精灵在背景后面，而且背景不透明
+                        __m256i behind = _mm256_cmpeq_epi8(_mm256_and_si256(sprData, behindBit), behindBit);
+                        __m256i bkWins = _mm256_andnot_si256(_mm256_cmpeq_epi8(bkIndex, zero), behind);
+                        sprColor = _selectAvx2(bkWins, result, sprColor);
+                    }
+                
+                    result = _selectAvx2(noSpr, result, sprColor);
+                }
+                
+                // 显示背景时每个像素都有颜色
+                _writeRGB32<SHOW_BG>(rgb + i*3, result, planes);
+            }
+            return i;
+        }
+#endif
+    };
+}
@@ -30,6 +30,9 @@ namespace ReNes {
         void init(Memory* mem)
         {
             _mem = mem;
+            
+            _mem->setIOWriteHandler<Control, &Control::_write4016>(0x4016, this);
+            _mem->setIOReadHandler<Control, &Control::_read4016>(0x4016, this);
         }
         
         inline
@@ -111,8 +114,43 @@ namespace ReNes {
         
     private:
         
+        // 写0x4016 2次，以设置从0x4016读取的硬件信息
+        void _write4016(uint16_t addr, uint8_t value)
+        {
+            int writeBitIndex = (_dstWrite + 1) % 2;
+            
+            _dstAddrTmp &= (0xFF << _dstWrite*8); // 清理相反的高/低位
+            _dstAddrTmp |= (value << writeBitIndex*8); // 设置对应位
+            
+            _dstWrite = (_dstWrite + 1) % 2;
+            
+            if (_dstWrite == 0)
+                _dstAddr = _dstAddrTmp;
+            
+            // 每次重新请求控制器的时候，重置按键
+            if (_dstWrite == 0 && _dstAddr == 0x100)
+            {
+                reset();
+            }
+        }
+        
+        void _read4016(uint16_t addr, uint8_t* value, bool* valid)
+        {
+            if (_dstAddr == 0x100)
+            {
+                *value = nextKeyStatue();
+                
+                // _dstWrite = 0; ?
+            }
+        }
+        
         Memory* _mem = 0;
         
+        // 0x4016 写入状态
+        int _dstWrite = 0;
+        uint16_t _dstAddrTmp = 0;
+        uint16_t _dstAddr = 0;
+        
         int _nextKey = KEY_A;
         bool _statues[__KEY_MAX];
     };
@@ -4,22 +4,18 @@
 #include <map>
 #include <set>
 #include "mem.hpp"
+#include "jit.hpp"
 #include <string>
 #include <vector>
 #include "type.hpp"
 
-
-#include <sstream>
-#include <iomanip>
-#include <iostream>
-
 namespace ReNes {
     
     // 栈偏移地址
     #define STACK_ADDR_OFFSET 0x0100
     
     // 寄存器引用
-    #define RENES_REGS auto& AC = regs.A;auto& XR = regs.X;auto& YR = regs.Y;auto& SP = regs.SP;auto& PC = regs.PC;auto& SR = *(uint8_t*)&regs.P;(void)AC;(void)XR;(void)YR;(void)SP;(void)PC;(void)SR;
+    #define RENES_REGS auto& AC = regs.A;auto& XR = regs.X;auto& YR = regs.Y;auto& SP = regs.SP;auto& PC = regs.PC;(void)AC;(void)XR;(void)YR;(void)SP;(void)PC;
 
     // 寻址模式
     // IMMIDIATE = 立即，INDEXED = 间接，跳转时 RELATIVE = 相对8bit，ABSOLUTE = 16bit
@@ -50,16 +46,6 @@ namespace ReNes {
         DATA_VALUE,
     };
     
-    template< typename T >
-    std::string int_to_hex( T i )
-    {
-        std::stringstream stream;
-        stream << "0x"
-        << std::setfill ('0') << std::setw(sizeof(T)*2)
-        << std::hex << std::uppercase << (int)i;
-        return stream.str();
-    }
-    
     // 指令标记
     enum CF{
         
@@ -146,296 +132,458 @@ namespace ReNes {
         int flags;  // 寄存器影响标签，用于检查执行错误
     };
     
-    // 根据目标打印指令日志
-    std::string cmd_str(CmdInfo info, uint16_t pc, Memory* mem)
+    // 未定义指令（非官方指令暂不支持），CF_NON只用于此项
+    #define RENES_CMD_UNDEFINED {"???", CF_NON, IMPLIED, 1, 0, 0}
+
+    // 指令表：按操作码排列的256项，取指令信息只需要一次下标访问
+    constexpr CmdInfo CMD_LIST[256] = {
+        
+        /* 0x00 (implied) BRK */ {"BRK", CF_BRK, IMPLIED, 1, 7, 0},
+        /* 0x01 ((indirect,X)) ORA (oper,X) */ {"ORA", CF_ORA, INDIRECT_X_INDEXED, 2, 6, 130},
+        /* 0x02 */ RENES_CMD_UNDEFINED,
+        /* 0x03 */ RENES_CMD_UNDEFINED,
+        /* 0x04 */ RENES_CMD_UNDEFINED,
+        /* 0x05 (zeropage) ORA oper */ {"ORA", CF_ORA, ZERO_PAGE, 2, 3, 130},
+        /* 0x06 (zeropage) ASL oper */ {"ASL", CF_ASL, ZERO_PAGE, 2, 5, 131},
+        /* 0x07 */ RENES_CMD_UNDEFINED,
+        /* 0x08 (implied) PHP */ {"PHP", CF_PHP, IMPLIED, 1, 3, 0},
+        /* 0x09 (immidiate) ORA #oper */ {"ORA", CF_ORA, IMMIDIATE, 2, 2, 130},
+        /* 0x0A (accumulator) ASL A */ {"ASL", CF_ASL, ACCUMULATOR, 1, 2, 131},
+        /* 0x0B */ RENES_CMD_UNDEFINED,
+        /* 0x0C */ RENES_CMD_UNDEFINED,
+        /* 0x0D (absolute) ORA oper */ {"ORA", CF_ORA, INDEXED_ABSOLUTE, 3, 4, 130},
+        /* 0x0E (absolute) ASL oper */ {"ASL", CF_ASL, INDEXED_ABSOLUTE, 3, 6, 131},
+        /* 0x0F */ RENES_CMD_UNDEFINED,
+        /* 0x10 (relative) BPL oper */ {"BPL", CF_BPL, RELATIVE, 2, 2, 0},
+        /* 0x11 ((indirect),Y) ORA (oper),Y */ {"ORA", CF_ORA, INDIRECT_INDEXED_Y, 2, 5, 130},
+        /* 0x12 */ RENES_CMD_UNDEFINED,
+        /* 0x13 */ RENES_CMD_UNDEFINED,
+        /* 0x14 */ RENES_CMD_UNDEFINED,
+        /* 0x15 (zeropage,X) ORA oper,X */ {"ORA", CF_ORA, ZERO_PAGE_X, 2, 4, 130},
+        /* 0x16 (zeropage,X) ASL oper,X */ {"ASL", CF_ASL, ZERO_PAGE_X, 2, 6, 131},
+        /* 0x17 */ RENES_CMD_UNDEFINED,
+        /* 0x18 (implied) CLC */ {"CLC", CF_CLC, IMPLIED, 1, 2, 0},
+        /* 0x19 (absolute,Y) ORA oper,Y */ {"ORA", CF_ORA, INDEXED_ABSOLUTE_Y, 3, 4, 130},
+        /* 0x1A */ RENES_CMD_UNDEFINED,
+        /* 0x1B */ RENES_CMD_UNDEFINED,
+        /* 0x1C */ RENES_CMD_UNDEFINED,
+        /* 0x1D (absolute,X) ORA oper,X */ {"ORA", CF_ORA, INDEXED_ABSOLUTE_X, 3, 4, 130},
+        /* 0x1E (absolute,X) ASL oper,X */ {"ASL", CF_ASL, INDEXED_ABSOLUTE_X, 3, 7, 131},
+        /* 0x1F */ RENES_CMD_UNDEFINED,
+        /* 0x20 (absolute) JSR oper */ {"JSR", CF_JSR, INDEXED_ABSOLUTE, 3, 6, 0},
+        /* 0x21 ((indirect,X)) AND (oper,X) */ {"AND", CF_AND, INDIRECT_X_INDEXED, 2, 6, 130},
+        /* 0x22 */ RENES_CMD_UNDEFINED,
+        /* 0x23 */ RENES_CMD_UNDEFINED,
+        /* 0x24 (zeropage) BIT oper */ {"BIT", CF_BIT, ZERO_PAGE, 2, 3, 2},
+        /* 0x25 (zeropage) AND oper */ {"AND", CF_AND, ZERO_PAGE, 2, 3, 130},
+        /* 0x26 (zeropage) ROL oper */ {"ROL", CF_ROL, ZERO_PAGE, 2, 5, 131},
+        /* 0x27 */ RENES_CMD_UNDEFINED,
+        /* 0x28 (implied) PHP */ {"PLP", CF_PLP, IMPLIED, 1, 4, 0},
+        /* 0x29 (immidiate) AND #oper */ {"AND", CF_AND, IMMIDIATE, 2, 2, 130},
+        /* 0x2A (accumulator) ROL A */ {"ROL", CF_ROL, ACCUMULATOR, 1, 2, 131},
+        /* 0x2B */ RENES_CMD_UNDEFINED,
+        /* 0x2C (absolute) BIT oper */ {"BIT", CF_BIT, INDEXED_ABSOLUTE, 3, 4, 2},
+        /* 0x2D (absolute) AND oper */ {"AND", CF_AND, INDEXED_ABSOLUTE, 3, 4, 130},
+        /* 0x2E (absolute) ROL oper */ {"ROL", CF_ROL, INDEXED_ABSOLUTE, 3, 6, 131},
+        /* 0x2F */ RENES_CMD_UNDEFINED,
+        /* 0x30 (relative) BMI oper */ {"BMI", CF_BMI, RELATIVE, 2, 2, 0},
+        /* 0x31 ((indirect),Y) AND (oper),Y */ {"AND", CF_AND, INDIRECT_INDEXED_Y, 2, 5, 130},
+        /* 0x32 */ RENES_CMD_UNDEFINED,
+        /* 0x33 */ RENES_CMD_UNDEFINED,
+        /* 0x34 */ RENES_CMD_UNDEFINED,
+        /* 0x35 (zeropage,X) AND oper,X */ {"AND", CF_AND, ZERO_PAGE_X, 2, 4, 130},
+        /* 0x36 (zeropage,X) ROL oper,X */ {"ROL", CF_ROL, ZERO_PAGE_X, 2, 6, 131},
+        /* 0x37 */ RENES_CMD_UNDEFINED,
+        /* 0x38 (implied) SEC */ {"SEC", CF_SEC, IMPLIED, 1, 2, 0},
+        /* 0x39 (absolute,Y) AND oper,Y */ {"AND", CF_AND, INDEXED_ABSOLUTE_Y, 3, 4, 130},
+        /* 0x3A */ RENES_CMD_UNDEFINED,
+        /* 0x3B */ RENES_CMD_UNDEFINED,
+        /* 0x3C */ RENES_CMD_UNDEFINED,
+        /* 0x3D (absolute,X) AND oper,X */ {"AND", CF_AND, INDEXED_ABSOLUTE_X, 3, 4, 130},
+        /* 0x3E (absolute,X) ROL oper,X */ {"ROL", CF_ROL, INDEXED_ABSOLUTE_X, 3, 7, 131},
+        /* 0x3F */ RENES_CMD_UNDEFINED,
+        /* 0x40 (implied) RTI */ {"RTI", CF_RTI, IMPLIED, 1, 6, 0},
+        /* 0x41 ((indirect,X)) EOR (oper,X) */ {"EOR", CF_EOR, INDIRECT_X_INDEXED, 2, 6, 130},
+        /* 0x42 */ RENES_CMD_UNDEFINED,
+        /* 0x43 */ RENES_CMD_UNDEFINED,
+        /* 0x44 */ RENES_CMD_UNDEFINED,
+        /* 0x45 (zeropage) EOR oper */ {"EOR", CF_EOR, ZERO_PAGE, 2, 3, 130},
+        /* 0x46 (zeropage) LSR oper */ {"LSR", CF_LSR, ZERO_PAGE, 2, 5, 3},
+        /* 0x47 */ RENES_CMD_UNDEFINED,
+        /* 0x48 (implied) PHA */ {"PHA", CF_PHA, IMPLIED, 1, 3, 0},
+        /* 0x49 (immidiate) EOR #oper */ {"EOR", CF_EOR, IMMIDIATE, 2, 2, 130},
+        /* 0x4A (accumulator) LSR A */ {"LSR", CF_LSR, ACCUMULATOR, 1, 2, 3},
+        /* 0x4B */ RENES_CMD_UNDEFINED,
+        /* 0x4C (absolute) JMP oper */ {"JMP", CF_JMP, INDEXED_ABSOLUTE, 3, 3, 0},
+        /* 0x4D (absolute) EOR oper */ {"EOR", CF_EOR, INDEXED_ABSOLUTE, 3, 4, 130},
+        /* 0x4E (absolute) LSR oper */ {"LSR", CF_LSR, INDEXED_ABSOLUTE, 3, 6, 3},
+        /* 0x4F */ RENES_CMD_UNDEFINED,
+        /* 0x50 (relative) BVC oper */ {"BVC", CF_BVC, RELATIVE, 2, 2, 0},
+        /* 0x51 ((indirect),Y) EOR (oper),Y */ {"EOR", CF_EOR, INDIRECT_INDEXED_Y, 2, 5, 130},
+        /* 0x52 */ RENES_CMD_UNDEFINED,
+        /* 0x53 */ RENES_CMD_UNDEFINED,
+        /* 0x54 */ RENES_CMD_UNDEFINED,
+        /* 0x55 (zeropage,X) EOR oper,X */ {"EOR", CF_EOR, ZERO_PAGE_X, 2, 4, 130},
+        /* 0x56 (zeropage,X) LSR oper,X */ {"LSR", CF_LSR, ZERO_PAGE_X, 2, 6, 3},
+        /* 0x57 */ RENES_CMD_UNDEFINED,
+        /* 0x58 (implied) CLI */ {"CLI", CF_CLI, IMPLIED, 1, 2, 0},
+        /* 0x59 (absolute,Y) EOR oper,Y */ {"EOR", CF_EOR, INDEXED_ABSOLUTE_Y, 3, 4, 130},
+        /* 0x5A */ RENES_CMD_UNDEFINED,
+        /* 0x5B */ RENES_CMD_UNDEFINED,
+        /* 0x5C */ RENES_CMD_UNDEFINED,
+        /* 0x5D (absolute,X) EOR oper,X */ {"EOR", CF_EOR, INDEXED_ABSOLUTE_X, 3, 4, 130},
+        /* 0x5E (absolute,X) LSR oper,X */ {"LSR", CF_LSR, INDEXED_ABSOLUTE_X, 3, 7, 3},
+        /* 0x5F */ RENES_CMD_UNDEFINED,
+        /* 0x60 (implied) RTS */ {"RTS", CF_RTS, IMPLIED, 1, 6, 0},
+        /* 0x61 ((indirect,X)) ADC (oper,X) */ {"ADC", CF_ADC, INDIRECT_X_INDEXED, 2, 6, 195},
+        /* 0x62 */ RENES_CMD_UNDEFINED,
+        /* 0x63 */ RENES_CMD_UNDEFINED,
+        /* 0x64 */ RENES_CMD_UNDEFINED,
+        /* 0x65 (zeropage) ADC oper */ {"ADC", CF_ADC, ZERO_PAGE, 2, 3, 195},
+        /* 0x66 (zeropage) ROR oper */ {"ROR", CF_ROR, ZERO_PAGE, 2, 5, 131},
+        /* 0x67 */ RENES_CMD_UNDEFINED,
+        /* 0x68 (implied) PLA */ {"PLA", CF_PLA, IMPLIED, 1, 4, 130},
+        /* 0x69 (immidiate) ADC #oper */ {"ADC", CF_ADC, IMMIDIATE, 2, 2, 195},
+        /* 0x6A (accumulator) ROR A */ {"ROR", CF_ROR, ACCUMULATOR, 1, 2, 131},
+        /* 0x6B */ RENES_CMD_UNDEFINED,
+        /* 0x6C (indirect) JMP (oper) */ {"JMP", CF_JMP, INDIRECT, 3, 5, 0},
+        /* 0x6D (absolute) ADC oper */ {"ADC", CF_ADC, INDEXED_ABSOLUTE, 3, 4, 195},
+        /* 0x6E (absolute) ROR oper */ {"ROR", CF_ROR, INDEXED_ABSOLUTE, 3, 6, 131},
+        /* 0x6F */ RENES_CMD_UNDEFINED,
+        /* 0x70 (relative) BVC oper */ {"BVS", CF_BVS, RELATIVE, 2, 2, 0},
+        /* 0x71 ((indirect),Y) ADC (oper),Y */ {"ADC", CF_ADC, INDIRECT_INDEXED_Y, 2, 5, 195},
+        /* 0x72 */ RENES_CMD_UNDEFINED,
+        /* 0x73 */ RENES_CMD_UNDEFINED,
+        /* 0x74 */ RENES_CMD_UNDEFINED,
+        /* 0x75 (zeropage,X) ADC oper,X */ {"ADC", CF_ADC, ZERO_PAGE_X, 2, 4, 195},
+        /* 0x76 (zeropage,X) ROR oper,X */ {"ROR", CF_ROR, ZERO_PAGE_X, 2, 6, 131},
+        /* 0x77 */ RENES_CMD_UNDEFINED,
+        /* 0x78 (implied) SEI */ {"SEI", CF_SEI, IMPLIED, 1, 2, 0},
+        /* 0x79 (absolute,Y) ADC oper,Y */ {"ADC", CF_ADC, INDEXED_ABSOLUTE_Y, 3, 4, 195},
+        /* 0x7A */ RENES_CMD_UNDEFINED,
+        /* 0x7B */ RENES_CMD_UNDEFINED,
+        /* 0x7C */ RENES_CMD_UNDEFINED,
+        /* 0x7D (absolute,X) ADC oper,X */ {"ADC", CF_ADC, INDEXED_ABSOLUTE_X, 3, 4, 195},
+        /* 0x7E (absolute,X) ROR oper,X */ {"ROR", CF_ROR, INDEXED_ABSOLUTE_X, 3, 7, 131},
+        /* 0x7F */ RENES_CMD_UNDEFINED,
+        /* 0x80 */ RENES_CMD_UNDEFINED,
+        /* 0x81 ((indirect,X)) STA (oper,X) */ {"STA", CF_STA, INDIRECT_X_INDEXED, 2, 6, 0},
+        /* 0x82 */ RENES_CMD_UNDEFINED,
+        /* 0x83 */ RENES_CMD_UNDEFINED,
+        /* 0x84 (zeropage) STY oper */ {"STY", CF_STY, ZERO_PAGE, 2, 3, 0},
+        /* 0x85 (zeropage) STA oper */ {"STA", CF_STA, ZERO_PAGE, 2, 3, 0},
+        /* 0x86 (zeropage) STX oper */ {"STX", CF_STX, ZERO_PAGE, 2, 3, 0},
+        /* 0x87 */ RENES_CMD_UNDEFINED,
+        /* 0x88 (implied) DEY */ {"DEY", CF_DEY, IMPLIED, 1, 2, 130},
+        /* 0x89 */ RENES_CMD_UNDEFINED,
+        /* 0x8A (implied) TXA */ {"TXA", CF_TXA, IMPLIED, 1, 2, 130},
+        /* 0x8B */ RENES_CMD_UNDEFINED,
+        /* 0x8C (absolute) STY oper */ {"STY", CF_STY, INDEXED_ABSOLUTE, 3, 4, 0},
+        /* 0x8D (absolute) STA oper */ {"STA", CF_STA, INDEXED_ABSOLUTE, 3, 4, 0},
+        /* 0x8E (absolute) STX oper */ {"STX", CF_STX, INDEXED_ABSOLUTE, 3, 4, 0},
+        /* 0x8F */ RENES_CMD_UNDEFINED,
+        /* 0x90 (relative) BCC oper */ {"BCC", CF_BCC, RELATIVE, 2, 2, 0},
+        /* 0x91 ((indirect),Y) STA (oper),Y */ {"STA", CF_STA, INDIRECT_INDEXED_Y, 2, 6, 0},
+        /* 0x92 */ RENES_CMD_UNDEFINED,
+        /* 0x93 */ RENES_CMD_UNDEFINED,
+        /* 0x94 (zeropage,X) STY oper,X */ {"STY", CF_STY, ZERO_PAGE_X, 2, 4, 0},
+        /* 0x95 (zeropage,X) STA oper,X */ {"STA", CF_STA, ZERO_PAGE_X, 2, 4, 0},
+        /* 0x96 (zeropage,Y) STX oper,Y */ {"STX", CF_STX, ZERO_PAGE_Y, 2, 4, 0},
+        /* 0x97 */ RENES_CMD_UNDEFINED,
+        /* 0x98 (implied) TYA */ {"TYA", CF_TYA, IMPLIED, 1, 2, 130},
+        /* 0x99 (absolute,Y) STA oper,Y */ {"STA", CF_STA, INDEXED_ABSOLUTE_Y, 3, 5, 0},
+        /* 0x9A (implied) TXS */ {"TXS", CF_TXS, IMPLIED, 1, 2, 130},
+        /* 0x9B */ RENES_CMD_UNDEFINED,
+        /* 0x9C */ RENES_CMD_UNDEFINED,
+        /* 0x9D (absolute,X) STA oper,X */ {"STA", CF_STA, INDEXED_ABSOLUTE_X, 3, 5, 0},
+        /* 0x9E */ RENES_CMD_UNDEFINED,
+        /* 0x9F */ RENES_CMD_UNDEFINED,
+        /* 0xA0 (immidiate) LDY #oper */ {"LDY", CF_LDY, IMMIDIATE, 2, 2, 130},
+        /* 0xA1 ((indirect,X)) LDA (oper,X) */ {"LDA", CF_LDA, INDIRECT_X_INDEXED, 2, 6, 130},
+        /* 0xA2 (immidiate) LDX #oper */ {"LDX", CF_LDX, IMMIDIATE, 2, 2, 130},
+        /* 0xA3 */ RENES_CMD_UNDEFINED,
+        /* 0xA4 (zeropage) LDY oper */ {"LDY", CF_LDY, ZERO_PAGE, 2, 3, 130},
+        /* 0xA5 (zeropage) LDA oper */ {"LDA", CF_LDA, ZERO_PAGE, 2, 3, 130},
+        /* 0xA6 (zeropage) LDX oper */ {"LDX", CF_LDX, ZERO_PAGE, 2, 3, 130},
+        /* 0xA7 */ RENES_CMD_UNDEFINED,
+        /* 0xA8 (implied) TAY */ {"TAY", CF_TAY, IMPLIED, 1, 2, 130},
+        /* 0xA9 (immidiate) LDA #oper */ {"LDA", CF_LDA, IMMIDIATE, 2, 2, 130},
+        /* 0xAA (implied) TAX */ {"TAX", CF_TAX, IMPLIED, 1, 2, 130},
+        /* 0xAB */ RENES_CMD_UNDEFINED,
+        /* 0xAC (absolute) LDY oper */ {"LDY", CF_LDY, INDEXED_ABSOLUTE, 3, 4, 130},
+        /* 0xAD (absolute) LDA oper */ {"LDA", CF_LDA, INDEXED_ABSOLUTE, 3, 4, 130},
+        /* 0xAE (absolute) LDX oper */ {"LDX", CF_LDX, INDEXED_ABSOLUTE, 3, 4, 130},
+        /* 0xAF */ RENES_CMD_UNDEFINED,
+        /* 0xB0 (relative) BCS oper */ {"BCS", CF_BCS, RELATIVE, 2, 2, 0},
+        /* 0xB1 ((indirect),Y) LDA (oper),Y */ {"LDA", CF_LDA, INDIRECT_INDEXED_Y, 2, 5, 130},
+        /* 0xB2 */ RENES_CMD_UNDEFINED,
+        /* 0xB3 */ RENES_CMD_UNDEFINED,
+        /* 0xB4 (zeropage,X) LDY oper,X */ {"LDY", CF_LDY, ZERO_PAGE_X, 2, 4, 130},
+        /* 0xB5 (zeropage,X) LDA oper,X */ {"LDA", CF_LDA, ZERO_PAGE_X, 2, 4, 130},
+        /* 0xB6 (zeropage,Y) LDX oper,Y */ {"LDX", CF_LDX, ZERO_PAGE_Y, 2, 4, 130},
+        /* 0xB7 */ RENES_CMD_UNDEFINED,
+        /* 0xB8 (implied) CLV */ {"CLV", CF_CLV, IMPLIED, 1, 2, 0},
+        /* 0xB9 (absolute,Y) LDA oper,Y */ {"LDA", CF_LDA, INDEXED_ABSOLUTE_Y, 3, 4, 130},
+        /* 0xBA (implied) TSX */ {"TSX", CF_TSX, IMPLIED, 1, 2, 130},
+        /* 0xBB */ RENES_CMD_UNDEFINED,
+        /* 0xBC (absolute,X) LDY oper,X */ {"LDY", CF_LDY, INDEXED_ABSOLUTE_X, 3, 4, 130},
+        /* 0xBD (absolute,X) LDA oper,X */ {"LDA", CF_LDA, INDEXED_ABSOLUTE_X, 3, 4, 130},
+        /* 0xBE (absolute,Y) LDX oper,Y */ {"LDX", CF_LDX, INDEXED_ABSOLUTE_Y, 3, 4, 130},
+        /* 0xBF */ RENES_CMD_UNDEFINED,
+        /* 0xC0 (immidiate) CPY #oper */ {"CPY", CF_CPY, IMMIDIATE, 2, 2, 131},
+        /* 0xC1 ((indirect,X)) CMP (oper,X) */ {"CMP", CF_CMP, INDIRECT_X_INDEXED, 2, 6, 131},
+        /* 0xC2 */ RENES_CMD_UNDEFINED,
+        /* 0xC3 */ RENES_CMD_UNDEFINED,
+        /* 0xC4 (zeropage) CPY oper */ {"CPY", CF_CPY, ZERO_PAGE, 2, 3, 131},
+        /* 0xC5 (zeropage) CMP oper */ {"CMP", CF_CMP, ZERO_PAGE, 2, 3, 131},
+        /* 0xC6 (zeropage) DEC oper */ {"DEC", CF_DEC, ZERO_PAGE, 2, 5, 130},
+        /* 0xC7 */ RENES_CMD_UNDEFINED,
+        /* 0xC8 (implied) INY */ {"INY", CF_INY, IMPLIED, 1, 2, 130},
+        /* 0xC9 (immidiate) CMP #oper */ {"CMP", CF_CMP, IMMIDIATE, 2, 2, 131},
+        /* 0xCA (implied) DEX */ {"DEX", CF_DEX, IMPLIED, 1, 2, 130},
+        /* 0xCB */ RENES_CMD_UNDEFINED,
+        /* 0xCC (absolute) CPY oper */ {"CPY", CF_CPY, INDEXED_ABSOLUTE, 3, 4, 131},
+        /* 0xCD (absolute) CMP oper */ {"CMP", CF_CMP, INDEXED_ABSOLUTE, 3, 4, 131},
+        /* 0xCE (absolute) DEC oper */ {"DEC", CF_DEC, INDEXED_ABSOLUTE, 3, 3, 130},
+        /* 0xCF */ RENES_CMD_UNDEFINED,
+        /* 0xD0 (relative) BNE oper */ {"BNE", CF_BNE, RELATIVE, 2, 2, 0},
+        /* 0xD1 ((indirect),Y) CMP (oper),Y */ {"CMP", CF_CMP, INDIRECT_INDEXED_Y, 2, 5, 131},
+        /* 0xD2 */ RENES_CMD_UNDEFINED,
+        /* 0xD3 */ RENES_CMD_UNDEFINED,
+        /* 0xD4 */ RENES_CMD_UNDEFINED,
+        /* 0xD5 (zeropage,X) CMP oper,X */ {"CMP", CF_CMP, ZERO_PAGE_X, 2, 4, 131},
+        /* 0xD6 (zeropage,X) DEC oper,X */ {"DEC", CF_DEC, ZERO_PAGE_X, 2, 6, 130},
+        /* 0xD7 */ RENES_CMD_UNDEFINED,
+        /* 0xD8 (implied) CLD */ {"CLD", CF_CLD, IMPLIED, 1, 2, 0},
+        /* 0xD9 (absolute,Y) CMP oper,Y */ {"CMP", CF_CMP, INDEXED_ABSOLUTE_Y, 3, 4, 131},
+        /* 0xDA */ RENES_CMD_UNDEFINED,
+        /* 0xDB */ RENES_CMD_UNDEFINED,
+        /* 0xDC */ RENES_CMD_UNDEFINED,
+        /* 0xDD (absolute,X) CMP oper,X */ {"CMP", CF_CMP, INDEXED_ABSOLUTE_X, 3, 4, 131},
+        /* 0xDE (absolute,X) DEC oper,X */ {"DEC", CF_DEC, INDEXED_ABSOLUTE_X, 3, 7, 130},
+        /* 0xDF */ RENES_CMD_UNDEFINED,
+        /* 0xE0 (immidiate) CPX #oper */ {"CPX", CF_CPX, IMMIDIATE, 2, 2, 131},
+        /* 0xE1 ((indirect,X)) SBC (oper,X) */ {"SBC", CF_SBC, INDIRECT_X_INDEXED, 2, 6, 195},
+        /* 0xE2 */ RENES_CMD_UNDEFINED,
+        /* 0xE3 */ RENES_CMD_UNDEFINED,
+        /* 0xE4 (zeropage) CPX oper */ {"CPX", CF_CPX, ZERO_PAGE, 2, 3, 131},
+        /* 0xE5 (zeropage) SBC oper */ {"SBC", CF_SBC, ZERO_PAGE, 2, 3, 195},
+        /* 0xE6 (zeropage) INC oper */ {"INC", CF_INC, ZERO_PAGE, 2, 5, 130},
+        /* 0xE7 */ RENES_CMD_UNDEFINED,
+        /* 0xE8 (implied) INX */ {"INX", CF_INX, IMPLIED, 1, 2, 130},
+        /* 0xE9 (immidiate) SBC #oper */ {"SBC", CF_SBC, IMMIDIATE, 2, 2, 195},
+        /* 0xEA (implied) NOP */ {"NOP", CF_NOP, IMPLIED, 1, 2, 0},
+        /* 0xEB */ RENES_CMD_UNDEFINED,
+        /* 0xEC (absolute) CPX oper */ {"CPX", CF_CPX, INDEXED_ABSOLUTE, 3, 4, 131},
+        /* 0xED (absolute) SBC oper */ {"SBC", CF_SBC, INDEXED_ABSOLUTE, 3, 4, 195},
+        /* 0xEE (absolute) INC oper */ {"INC", CF_INC, INDEXED_ABSOLUTE, 3, 6, 130},
+        /* 0xEF */ RENES_CMD_UNDEFINED,
+        /* 0xF0 (relative) BEQ oper */ {"BEQ", CF_BEQ, RELATIVE, 2, 2, 0},
+        /* 0xF1 ((indirect),Y) SBC (oper),Y */ {"SBC", CF_SBC, INDIRECT_INDEXED_Y, 2, 5, 195},
+        /* 0xF2 */ RENES_CMD_UNDEFINED,
+        /* 0xF3 */ RENES_CMD_UNDEFINED,
+        /* 0xF4 */ RENES_CMD_UNDEFINED,
+        /* 0xF5 (zeropage,X) SBC oper,X */ {"SBC", CF_SBC, ZERO_PAGE_X, 2, 4, 195},
+        /* 0xF6 (zeropage,X) INC oper,X */ {"INC", CF_INC, ZERO_PAGE_X, 2, 6, 130},
+        /* 0xF7 */ RENES_CMD_UNDEFINED,
+        /* 0xF8 (implied) SED */ {"SED", CF_SED, IMPLIED, 1, 2, 0},
+        /* 0xF9 (absolute,Y) SBC oper,Y */ {"SBC", CF_SBC, INDEXED_ABSOLUTE_Y, 3, 4, 195},
+        /* 0xFA */ RENES_CMD_UNDEFINED,
+        /* 0xFB */ RENES_CMD_UNDEFINED,
+        /* 0xFC */ RENES_CMD_UNDEFINED,
+        /* 0xFD (absolute,X) SBC oper,X */ {"SBC", CF_SBC, INDEXED_ABSOLUTE_X, 3, 4, 195},
+        /* 0xFE (absolute,X) INC oper,X */ {"INC", CF_INC, INDEXED_ABSOLUTE_X, 3, 7, 130},
+        /* 0xFF */ RENES_CMD_UNDEFINED,
+    };
+    
+    #undef RENES_CMD_UNDEFINED
+    
+    // 是否是已定义的指令
+    constexpr bool cmd_defined(uint8_t cmd)
+    {
+        return CMD_LIST[cmd].cf != CF_NON;
+    }
+    
+    //--------------------------------------
+    // 反汇编，结果写入调用者提供的缓冲区，不分配内存，可以在长时间运行的跟踪中使用
+    
+    // 反汇编结果的最大长度（包括结尾的0），最长的是 "BCC #0x0000(-128)"
+    const static size_t CMD_STR_MAX = 32;
+    
+    // 操作数的格式: 前缀 + 十六进制操作数 + 后缀
+    struct OperFormat {
+        const char* prefix;
+        int bytes;          // 操作数的字节数，0 表示不打印操作数
+        const char* suffix;
+    };
+    
+    // 按寻址模式排列
+    constexpr OperFormat OPER_FORMAT[] = {
+        /* IMPLIED */               {"", 0, ""},
+        /* ACCUMULATOR */           {"A", 0, ""},
+        /* RELATIVE */              {"#", 2, ""},       // 打印跳转目标地址和偏移
+        /* ZERO_PAGE */             {"", 1, ""},
+        /* ZERO_PAGE_X */           {"", 1, ",X"},
+        /* ZERO_PAGE_Y */           {"", 1, ",Y"},
+        /* INDEXED_ABSOLUTE */      {"", 2, ""},
+        /* INDEXED_ABSOLUTE_X */    {"", 2, ",X"},
+        /* INDEXED_ABSOLUTE_Y */    {"", 2, ",Y"},
+        /* IMMIDIATE */             {"#", 1, ""},
+        /* INDIRECT */              {"(", 2, ")"},
+        /* INDIRECT_X_INDEXED */    {"(", 1, ", X)"},
+        /* INDIRECT_INDEXED_Y */    {"(", 1, "),Y"},
+        /* DATA_VALUE */            {"", 0, ""},
+    };
+    
+    static_assert(sizeof(OPER_FORMAT)/sizeof(*OPER_FORMAT) == DATA_VALUE + 1, "OPER_FORMAT 需要和 AddressingMode 一一对应");
+    
+    constexpr char HEX_DIGITS[] = "0123456789ABCDEF";
+    
+    // 追加字符串，p 不会超过 end（end 处留给结尾的0）
+    inline char* str_append(char* p, const char* end, const char* s)
+    {
+        while (*s && p < end)
+            *p++ = *s++;
+        return p;
+    }
+    
+    // 追加 "0x" 开头的 digits 位十六进制数
+    inline char* str_append_hex(char* p, const char* end, uint32_t value, int digits)
+    {
+        p = str_append(p, end, "0x");
+        for (int i=digits-1; i>=0 && p < end; i--)
+            *p++ = HEX_DIGITS[(value >> (i*4)) & 0xF];
+        return p;
+    }
+    
+    // 追加十进制数
+    inline char* str_append_int(char* p, const char* end, int value)
     {
-        const std::string& cmd = info.name;
-        AddressingMode mode = info.mode;
+        if (value < 0 && p < end)
+        {
+            *p++ = '-';
+            value = -value;
+        }
         
-        std::function<std::string(DST)> dstCode = [](DST dst){
-            
-            const std::map<DST, std::string> REGS_NAME = {
-                {DST_REGS_A, "A"},
-                {DST_REGS_X, "X"},
-                {DST_REGS_Y, "Y"},
-            };
-            
-            if (RENES_SET_FIND(REGS_NAME, dst))
-            {
-                return REGS_NAME.at(dst);
-            }
-            return std::string("C");
-        };
+        char digits[12];
+        int count = 0;
+        do {
+            digits[count++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
         
+        while (count > 0 && p < end)
+            *p++ = digits[--count];
+        return p;
+    }
+    
+    // 反汇编 pc 处的指令，例如 "LDA 0x0200,X"、"BNE #0xC012(-6)"，返回写入的长度（不包括结尾的0）
+    inline size_t cmd_str(char* buf, size_t size, const CmdInfo& info, uint16_t pc, const Memory* mem)
+    {
+        if (size == 0)
+            return 0;
+        
+        char* p = buf;
+        const char* end = buf + size - 1;
+        
+        p = str_append(p, end, info.name);
+        p = str_append(p, end, " ");
+        
+        const OperFormat& format = OPER_FORMAT[info.mode];
+        p = str_append(p, end, format.prefix);
         
-        std::function<std::string(AddressingMode)> operCode = [cmd, &info, pc, mem](AddressingMode mode)
+        uint16_t dataAddr = pc + 1; // 操作数位置 = PC + 1
+        if (info.mode == RELATIVE)
         {
-            uint16_t dataAddr = pc + 1; // 操作数位置 = PC + 1
-            std::string res;
-            bool immidiate = false;
-            int8_t immidiate_value = 0;
-            
-            switch (mode)
-            {
-                case RELATIVE:
-                case IMMIDIATE:
-                {
-                    immidiate_value = mem->get8bitData(dataAddr);
-                    immidiate = true;
-                    break;
-                }
-                case ZERO_PAGE:
-                {
-                    res = int_to_hex(mem->get8bitData(dataAddr));
-                    break;
-                }
-                case ZERO_PAGE_X:
-                {
-                    res = int_to_hex(mem->get8bitData(dataAddr)) + ",X";
-                    break;
-                }
-                case ZERO_PAGE_Y:
-                {
-                    res = int_to_hex(mem->get8bitData(dataAddr)) + ",Y";
-                    break;
-                }
-                case INDEXED_ABSOLUTE:
-                {
-                    res = int_to_hex(mem->get16bitData(dataAddr));
-                    break;
-                }
-                case INDEXED_ABSOLUTE_X:
-                {
-                    res = int_to_hex(mem->get16bitData(dataAddr)) + ",X";
-                    break;
-                }
-                case INDEXED_ABSOLUTE_Y:
-                {
-                    res = int_to_hex(mem->get16bitData(dataAddr)) + ",Y";
-                    break;
-                }
-                case INDIRECT:
-                {
-                    res = "(" + int_to_hex(mem->get16bitData(dataAddr)) + ")";
-                    break;
-                }
-                case INDIRECT_X_INDEXED:
-                {
-                    res = "(" + int_to_hex(mem->get8bitData(dataAddr)) + ", X)";
-                    break;
-                }
-                case INDIRECT_INDEXED_Y:
-                {
-                    res = "(" + int_to_hex(mem->get8bitData(dataAddr)) + "),Y";
-                    break;
-                }
-                case IMPLIED:
-                {
-                    break;
-                }
-                case ACCUMULATOR:
-                {
-                    res = "A";//int_to_hex(regs.A);
-                    break;
-                }
-                default:
-                    assert(!"error!");
-                    break;
-            }
-            
-            if (immidiate)
-            {
-                // 将跳转地址计算出来
-                int addr = 0;
-                const static char* JMP_STR[] = {
-                    "BCC",
-                    "BCS",
-                    "BMI",
-                    "BEQ",
-                    "BNE",
-                    "BPL",
-                    "BVC",
-                    "BVS"
-                };
-                if (RENES_ARRAY_FIND(JMP_STR, cmd))
-                {
-                    addr = pc + info.bytes;
-                    res = std::string("#") + int_to_hex((uint16_t)(immidiate_value + addr)) + "("+std::to_string(immidiate_value)+")";
-                }
-                else
-                {
-                    res = std::string("#") + int_to_hex((uint8_t)(immidiate_value + addr));
-                }
-                
-            }
-            
-            return res;
-        };
+            // 将跳转地址计算出来
+            int8_t offset = mem->get8bitData(dataAddr);
+            p = str_append_hex(p, end, (uint16_t)(pc + info.bytes + offset), 4);
+            p = str_append(p, end, "(");
+            p = str_append_int(p, end, offset);
+            p = str_append(p, end, ")");
+        }
+        else if (format.bytes == 1)
+        {
+            p = str_append_hex(p, end, mem->get8bitData(dataAddr), 2);
+        }
+        else if (format.bytes == 2)
+        {
+            p = str_append_hex(p, end, mem->get16bitData(dataAddr), 4);
+        }
         
-        std::string oper = operCode(mode);
+        p = str_append(p, end, format.suffix);
+        *p = 0;
         
-        return cmd + " " + oper;
-        //            log("%s %s\n", cmd.c_str(),  oper.c_str());
+        return p - buf;
     }
     
-    const std::map<uint8_t, CmdInfo> CMD_LIST = {
-
-        /* (immidiate) ADC #oper */ {0x69, {"ADC", CF_ADC, IMMIDIATE, 2, 2, 195}},
-        /* (zeropage) ADC oper */ {0x65, {"ADC", CF_ADC, ZERO_PAGE, 2, 3, 195}},
-        /* (zeropage,X) ADC oper,X */ {0x75, {"ADC", CF_ADC, ZERO_PAGE_X, 2, 4, 195}},
-        /* (absolute) ADC oper */ {0x6D, {"ADC", CF_ADC, INDEXED_ABSOLUTE, 3, 4, 195}},
-        /* (absolute,X) ADC oper,X */ {0x7D, {"ADC", CF_ADC, INDEXED_ABSOLUTE_X, 3, 4, 195}},
-        /* (absolute,Y) ADC oper,Y */ {0x79, {"ADC", CF_ADC, INDEXED_ABSOLUTE_Y, 3, 4, 195}},
-        /* ((indirect,X)) ADC (oper,X) */ {0x61, {"ADC", CF_ADC, INDIRECT_X_INDEXED, 2, 6, 195}},
-        /* ((indirect),Y) ADC (oper),Y */ {0x71, {"ADC", CF_ADC, INDIRECT_INDEXED_Y, 2, 5, 195}},
-        /* (immidiate) AND #oper */ {0x29, {"AND", CF_AND, IMMIDIATE, 2, 2, 130}},
-        /* (zeropage) AND oper */ {0x25, {"AND", CF_AND, ZERO_PAGE, 2, 3, 130}},
-        /* (zeropage,X) AND oper,X */ {0x35, {"AND", CF_AND, ZERO_PAGE_X, 2, 4, 130}},
-        /* (absolute) AND oper */ {0x2D, {"AND", CF_AND, INDEXED_ABSOLUTE, 3, 4, 130}},
-        /* (absolute,X) AND oper,X */ {0x3D, {"AND", CF_AND, INDEXED_ABSOLUTE_X, 3, 4, 130}},
-        /* (absolute,Y) AND oper,Y */ {0x39, {"AND", CF_AND, INDEXED_ABSOLUTE_Y, 3, 4, 130}},
-        /* ((indirect,X)) AND (oper,X) */ {0x21, {"AND", CF_AND, INDIRECT_X_INDEXED, 2, 6, 130}},
-        /* ((indirect),Y) AND (oper),Y */ {0x31, {"AND", CF_AND, INDIRECT_INDEXED_Y, 2, 5, 130}},
-        /* (accumulator) ASL A */ {0x0A, {"ASL", CF_ASL, ACCUMULATOR, 1, 2, 131}},
-        /* (zeropage) ASL oper */ {0x06, {"ASL", CF_ASL, ZERO_PAGE, 2, 5, 131}},
-        /* (zeropage,X) ASL oper,X */ {0x16, {"ASL", CF_ASL, ZERO_PAGE_X, 2, 6, 131}},
-        /* (absolute) ASL oper */ {0x0E, {"ASL", CF_ASL, INDEXED_ABSOLUTE, 3, 6, 131}},
-        /* (absolute,X) ASL oper,X */ {0x1E, {"ASL", CF_ASL, INDEXED_ABSOLUTE_X, 3, 7, 131}},
-        /* (relative) BCC oper */ {0x90, {"BCC", CF_BCC, RELATIVE, 2, 2, 0}},
-        /* (relative) BCS oper */ {0xB0, {"BCS", CF_BCS, RELATIVE, 2, 2, 0}},
-        /* (relative) BEQ oper */ {0xF0, {"BEQ", CF_BEQ, RELATIVE, 2, 2, 0}},
-        /* (zeropage) BIT oper */ {0x24, {"BIT", CF_BIT, ZERO_PAGE, 2, 3, 2}},
-        /* (absolute) BIT oper */ {0x2C, {"BIT", CF_BIT, INDEXED_ABSOLUTE, 3, 4, 2}},
-        /* (relative) BMI oper */ {0x30, {"BMI", CF_BMI, RELATIVE, 2, 2, 0}},
-        /* (relative) BNE oper */ {0xD0, {"BNE", CF_BNE, RELATIVE, 2, 2, 0}},
-        /* (relative) BPL oper */ {0x10, {"BPL", CF_BPL, RELATIVE, 2, 2, 0}},
-        /* (implied) BRK */ {0x00, {"BRK", CF_BRK, IMPLIED, 1, 7, 0}},
-        /* (relative) BVC oper */ {0x50, {"BVC", CF_BVC, RELATIVE, 2, 2, 0}},
-        /* (relative) BVC oper */ {0x70, {"BVS", CF_BVS, RELATIVE, 2, 2, 0}},
-        /* (implied) CLC */ {0x18, {"CLC", CF_CLC, IMPLIED, 1, 2, 0}},
-        /* (implied) CLD */ {0xD8, {"CLD", CF_CLD, IMPLIED, 1, 2, 0}},
-        /* (implied) CLI */ {0x58, {"CLI", CF_CLI, IMPLIED, 1, 2, 0}},
-        /* (implied) CLV */ {0xB8, {"CLV", CF_CLV, IMPLIED, 1, 2, 0}},
-        /* (immidiate) CMP #oper */ {0xC9, {"CMP", CF_CMP, IMMIDIATE, 2, 2, 131}},
-        /* (zeropage) CMP oper */ {0xC5, {"CMP", CF_CMP, ZERO_PAGE, 2, 3, 131}},
-        /* (zeropage,X) CMP oper,X */ {0xD5, {"CMP", CF_CMP, ZERO_PAGE_X, 2, 4, 131}},
-        /* (absolute) CMP oper */ {0xCD, {"CMP", CF_CMP, INDEXED_ABSOLUTE, 3, 4, 131}},
-        /* (absolute,X) CMP oper,X */ {0xDD, {"CMP", CF_CMP, INDEXED_ABSOLUTE_X, 3, 4, 131}},
-        /* (absolute,Y) CMP oper,Y */ {0xD9, {"CMP", CF_CMP, INDEXED_ABSOLUTE_Y, 3, 4, 131}},
-        /* ((indirect,X)) CMP (oper,X) */ {0xC1, {"CMP", CF_CMP, INDIRECT_X_INDEXED, 2, 6, 131}},
-        /* ((indirect),Y) CMP (oper),Y */ {0xD1, {"CMP", CF_CMP, INDIRECT_INDEXED_Y, 2, 5, 131}},
-        /* (immidiate) CPX #oper */ {0xE0, {"CPX", CF_CPX, IMMIDIATE, 2, 2, 131}},
-        /* (zeropage) CPX oper */ {0xE4, {"CPX", CF_CPX, ZERO_PAGE, 2, 3, 131}},
-        /* (absolute) CPX oper */ {0xEC, {"CPX", CF_CPX, INDEXED_ABSOLUTE, 3, 4, 131}},
-        /* (immidiate) CPY #oper */ {0xC0, {"CPY", CF_CPY, IMMIDIATE, 2, 2, 131}},
-        /* (zeropage) CPY oper */ {0xC4, {"CPY", CF_CPY, ZERO_PAGE, 2, 3, 131}},
-        /* (absolute) CPY oper */ {0xCC, {"CPY", CF_CPY, INDEXED_ABSOLUTE, 3, 4, 131}},
-        /* (zeropage) DEC oper */ {0xC6, {"DEC", CF_DEC, ZERO_PAGE, 2, 5, 130}},
-        /* (zeropage,X) DEC oper,X */ {0xD6, {"DEC", CF_DEC, ZERO_PAGE_X, 2, 6, 130}},
-        /* (absolute) DEC oper */ {0xCE, {"DEC", CF_DEC, INDEXED_ABSOLUTE, 3, 3, 130}},
-        /* (absolute,X) DEC oper,X */ {0xDE, {"DEC", CF_DEC, INDEXED_ABSOLUTE_X, 3, 7, 130}},
-        /* (implied) DEX */ {0xCA, {"DEX", CF_DEX, IMPLIED, 1, 2, 130}},
-        /* (implied) DEY */ {0x88, {"DEY", CF_DEY, IMPLIED, 1, 2, 130}},
-        /* (immidiate) EOR #oper */ {0x49, {"EOR", CF_EOR, IMMIDIATE, 2, 2, 130}},
-        /* (zeropage) EOR oper */ {0x45, {"EOR", CF_EOR, ZERO_PAGE, 2, 3, 130}},
-        /* (zeropage,X) EOR oper,X */ {0x55, {"EOR", CF_EOR, ZERO_PAGE_X, 2, 4, 130}},
-        /* (absolute) EOR oper */ {0x4D, {"EOR", CF_EOR, INDEXED_ABSOLUTE, 3, 4, 130}},
-        /* (absolute,X) EOR oper,X */ {0x5D, {"EOR", CF_EOR, INDEXED_ABSOLUTE_X, 3, 4, 130}},
-        /* (absolute,Y) EOR oper,Y */ {0x59, {"EOR", CF_EOR, INDEXED_ABSOLUTE_Y, 3, 4, 130}},
-        /* ((indirect,X)) EOR (oper,X) */ {0x41, {"EOR", CF_EOR, INDIRECT_X_INDEXED, 2, 6, 130}},
-        /* ((indirect),Y) EOR (oper),Y */ {0x51, {"EOR", CF_EOR, INDIRECT_INDEXED_Y, 2, 5, 130}},
-        /* (zeropage) INC oper */ {0xE6, {"INC", CF_INC, ZERO_PAGE, 2, 5, 130}},
-        /* (zeropage,X) INC oper,X */ {0xF6, {"INC", CF_INC, ZERO_PAGE_X, 2, 6, 130}},
-        /* (absolute) INC oper */ {0xEE, {"INC", CF_INC, INDEXED_ABSOLUTE, 3, 6, 130}},
-        /* (absolute,X) INC oper,X */ {0xFE, {"INC", CF_INC, INDEXED_ABSOLUTE_X, 3, 7, 130}},
-        /* (implied) INX */ {0xE8, {"INX", CF_INX, IMPLIED, 1, 2, 130}},
-        /* (implied) INY */ {0xC8, {"INY", CF_INY, IMPLIED, 1, 2, 130}},
-        /* (absolute) JMP oper */ {0x4C, {"JMP", CF_JMP, INDEXED_ABSOLUTE, 3, 3, 0}},
-        /* (indirect) JMP (oper) */ {0x6C, {"JMP", CF_JMP, INDIRECT, 3, 5, 0}},
-        /* (absolute) JSR oper */ {0x20, {"JSR", CF_JSR, INDEXED_ABSOLUTE, 3, 6, 0}},
-        /* (immidiate) LDA #oper */ {0xA9, {"LDA", CF_LDA, IMMIDIATE, 2, 2, 130}},
-        /* (zeropage) LDA oper */ {0xA5, {"LDA", CF_LDA, ZERO_PAGE, 2, 3, 130}},
-        /* (zeropage,X) LDA oper,X */ {0xB5, {"LDA", CF_LDA, ZERO_PAGE_X, 2, 4, 130}},
-        /* (absolute) LDA oper */ {0xAD, {"LDA", CF_LDA, INDEXED_ABSOLUTE, 3, 4, 130}},
-        /* (absolute,X) LDA oper,X */ {0xBD, {"LDA", CF_LDA, INDEXED_ABSOLUTE_X, 3, 4, 130}},
-        /* (absolute,Y) LDA oper,Y */ {0xB9, {"LDA", CF_LDA, INDEXED_ABSOLUTE_Y, 3, 4, 130}},
-        /* ((indirect,X)) LDA (oper,X) */ {0xA1, {"LDA", CF_LDA, INDIRECT_X_INDEXED, 2, 6, 130}},
-        /* ((indirect),Y) LDA (oper),Y */ {0xB1, {"LDA", CF_LDA, INDIRECT_INDEXED_Y, 2, 5, 130}},
-        /* (immidiate) LDX #oper */ {0xA2, {"LDX", CF_LDX, IMMIDIATE, 2, 2, 130}},
-        /* (zeropage) LDX oper */ {0xA6, {"LDX", CF_LDX, ZERO_PAGE, 2, 3, 130}},
-        /* (zeropage,Y) LDX oper,Y */ {0xB6, {"LDX", CF_LDX, ZERO_PAGE_Y, 2, 4, 130}},
-        /* (absolute) LDX oper */ {0xAE, {"LDX", CF_LDX, INDEXED_ABSOLUTE, 3, 4, 130}},
-        /* (absolute,Y) LDX oper,Y */ {0xBE, {"LDX", CF_LDX, INDEXED_ABSOLUTE_Y, 3, 4, 130}},
-        /* (immidiate) LDY #oper */ {0xA0, {"LDY", CF_LDY, IMMIDIATE, 2, 2, 130}},
-        /* (zeropage) LDY oper */ {0xA4, {"LDY", CF_LDY, ZERO_PAGE, 2, 3, 130}},
-        /* (zeropage,X) LDY oper,X */ {0xB4, {"LDY", CF_LDY, ZERO_PAGE_X, 2, 4, 130}},
-        /* (absolute) LDY oper */ {0xAC, {"LDY", CF_LDY, INDEXED_ABSOLUTE, 3, 4, 130}},
-        /* (absolute,X) LDY oper,X */ {0xBC, {"LDY", CF_LDY, INDEXED_ABSOLUTE_X, 3, 4, 130}},
-        /* (accumulator) LSR A */ {0x4A, {"LSR", CF_LSR, ACCUMULATOR, 1, 2, 3}},
-        /* (zeropage) LSR oper */ {0x46, {"LSR", CF_LSR, ZERO_PAGE, 2, 5, 3}},
-        /* (zeropage,X) LSR oper,X */ {0x56, {"LSR", CF_LSR, ZERO_PAGE_X, 2, 6, 3}},
-        /* (absolute) LSR oper */ {0x4E, {"LSR", CF_LSR, INDEXED_ABSOLUTE, 3, 6, 3}},
-        /* (absolute,X) LSR oper,X */ {0x5E, {"LSR", CF_LSR, INDEXED_ABSOLUTE_X, 3, 7, 3}},
-        /* (implied) NOP */ {0xEA, {"NOP", CF_NOP, IMPLIED, 1, 2, 0}},
-        /* (immidiate) ORA #oper */ {0x09, {"ORA", CF_ORA, IMMIDIATE, 2, 2, 130}},
-        /* (zeropage) ORA oper */ {0x05, {"ORA", CF_ORA, ZERO_PAGE, 2, 3, 130}},
-        /* (zeropage,X) ORA oper,X */ {0x15, {"ORA", CF_ORA, ZERO_PAGE_X, 2, 4, 130}},
-        /* (absolute) ORA oper */ {0x0D, {"ORA", CF_ORA, INDEXED_ABSOLUTE, 3, 4, 130}},
-        /* (absolute,X) ORA oper,X */ {0x1D, {"ORA", CF_ORA, INDEXED_ABSOLUTE_X, 3, 4, 130}},
-        /* (absolute,Y) ORA oper,Y */ {0x19, {"ORA", CF_ORA, INDEXED_ABSOLUTE_Y, 3, 4, 130}},
-        /* ((indirect,X)) ORA (oper,X) */ {0x01, {"ORA", CF_ORA, INDIRECT_X_INDEXED, 2, 6, 130}},
-        /* ((indirect),Y) ORA (oper),Y */ {0x11, {"ORA", CF_ORA, INDIRECT_INDEXED_Y, 2, 5, 130}},
-        /* (implied) PHA */ {0x48, {"PHA", CF_PHA, IMPLIED, 1, 3, 0}},
-        /* (implied) PHP */ {0x08, {"PHP", CF_PHP, IMPLIED, 1, 3, 0}},
-        /* (implied) PLA */ {0x68, {"PLA", CF_PLA, IMPLIED, 1, 4, 130}},
-        /* (implied) PHP */ {0x28, {"PLP", CF_PLP, IMPLIED, 1, 4, 0}},
-        /* (accumulator) ROL A */ {0x2A, {"ROL", CF_ROL, ACCUMULATOR, 1, 2, 131}},
-        /* (zeropage) ROL oper */ {0x26, {"ROL", CF_ROL, ZERO_PAGE, 2, 5, 131}},
-        /* (zeropage,X) ROL oper,X */ {0x36, {"ROL", CF_ROL, ZERO_PAGE_X, 2, 6, 131}},
-        /* (absolute) ROL oper */ {0x2E, {"ROL", CF_ROL, INDEXED_ABSOLUTE, 3, 6, 131}},
-        /* (absolute,X) ROL oper,X */ {0x3E, {"ROL", CF_ROL, INDEXED_ABSOLUTE_X, 3, 7, 131}},
-        /* (accumulator) ROR A */ {0x6A, {"ROR", CF_ROR, ACCUMULATOR, 1, 2, 131}},
-        /* (zeropage) ROR oper */ {0x66, {"ROR", CF_ROR, ZERO_PAGE, 2, 5, 131}},
-        /* (zeropage,X) ROR oper,X */ {0x76, {"ROR", CF_ROR, ZERO_PAGE_X, 2, 6, 131}},
-        /* (absolute) ROR oper */ {0x6E, {"ROR", CF_ROR, INDEXED_ABSOLUTE, 3, 6, 131}},
-        /* (absolute,X) ROR oper,X */ {0x7E, {"ROR", CF_ROR, INDEXED_ABSOLUTE_X, 3, 7, 131}},
-        /* (implied) RTI */ {0x40, {"RTI", CF_RTI, IMPLIED, 1, 6, 0}},
-        /* (implied) RTS */ {0x60, {"RTS", CF_RTS, IMPLIED, 1, 6, 0}},
-        /* (immidiate) SBC #oper */ {0xE9, {"SBC", CF_SBC, IMMIDIATE, 2, 2, 195}},
-        /* (zeropage) SBC oper */ {0xE5, {"SBC", CF_SBC, ZERO_PAGE, 2, 3, 195}},
-        /* (zeropage,X) SBC oper,X */ {0xF5, {"SBC", CF_SBC, ZERO_PAGE_X, 2, 4, 195}},
-        /* (absolute) SBC oper */ {0xED, {"SBC", CF_SBC, INDEXED_ABSOLUTE, 3, 4, 195}},
-        /* (absolute,X) SBC oper,X */ {0xFD, {"SBC", CF_SBC, INDEXED_ABSOLUTE_X, 3, 4, 195}},
-        /* (absolute,Y) SBC oper,Y */ {0xF9, {"SBC", CF_SBC, INDEXED_ABSOLUTE_Y, 3, 4, 195}},
-        /* ((indirect,X)) SBC (oper,X) */ {0xE1, {"SBC", CF_SBC, INDIRECT_X_INDEXED, 2, 6, 195}},
-        /* ((indirect),Y) SBC (oper),Y */ {0xF1, {"SBC", CF_SBC, INDIRECT_INDEXED_Y, 2, 5, 195}},
-        /* (implied) SEC */ {0x38, {"SEC", CF_SEC, IMPLIED, 1, 2, 0}},
-        /* (implied) SED */ {0xF8, {"SED", CF_SED, IMPLIED, 1, 2, 0}},
-        /* (implied) SEI */ {0x78, {"SEI", CF_SEI, IMPLIED, 1, 2, 0}},
-        /* (zeropage) STA oper */ {0x85, {"STA", CF_STA, ZERO_PAGE, 2, 3, 0}},
-        /* (zeropage,X) STA oper,X */ {0x95, {"STA", CF_STA, ZERO_PAGE_X, 2, 4, 0}},
-        /* (absolute) STA oper */ {0x8D, {"STA", CF_STA, INDEXED_ABSOLUTE, 3, 4, 0}},
-        /* (absolute,X) STA oper,X */ {0x9D, {"STA", CF_STA, INDEXED_ABSOLUTE_X, 3, 5, 0}},
-        /* (absolute,Y) STA oper,Y */ {0x99, {"STA", CF_STA, INDEXED_ABSOLUTE_Y, 3, 5, 0}},
-        /* ((indirect,X)) STA (oper,X) */ {0x81, {"STA", CF_STA, INDIRECT_X_INDEXED, 2, 6, 0}},
-        /* ((indirect),Y) STA (oper),Y */ {0x91, {"STA", CF_STA, INDIRECT_INDEXED_Y, 2, 6, 0}},
-        /* (zeropage) STX oper */ {0x86, {"STX", CF_STX, ZERO_PAGE, 2, 3, 0}},
-        /* (zeropage,Y) STX oper,Y */ {0x96, {"STX", CF_STX, ZERO_PAGE_Y, 2, 4, 0}},
-        /* (absolute) STX oper */ {0x8E, {"STX", CF_STX, INDEXED_ABSOLUTE, 3, 4, 0}},
-        /* (zeropage) STY oper */ {0x84, {"STY", CF_STY, ZERO_PAGE, 2, 3, 0}},
-        /* (zeropage,X) STY oper,X */ {0x94, {"STY", CF_STY, ZERO_PAGE_X, 2, 4, 0}},
-        /* (absolute) STY oper */ {0x8C, {"STY", CF_STY, INDEXED_ABSOLUTE, 3, 4, 0}},
-        /* (implied) TAX */ {0xAA, {"TAX", CF_TAX, IMPLIED, 1, 2, 130}},
-        /* (implied) TAY */ {0xA8, {"TAY", CF_TAY, IMPLIED, 1, 2, 130}},
-        /* (implied) TSX */ {0xBA, {"TSX", CF_TSX, IMPLIED, 1, 2, 130}},
-        /* (implied) TXA */ {0x8A, {"TXA", CF_TXA, IMPLIED, 1, 2, 130}},
-        /* (implied) TXS */ {0x9A, {"TXS", CF_TXS, IMPLIED, 1, 2, 130}},
-        /* (implied) TYA */ {0x98, {"TYA", CF_TYA, IMPLIED, 1, 2, 130}},
-    };
+    // 反汇编一行，例如 "[0xC000]\t\tSEI \n"，未定义的指令打印操作码。*bytes 返回指令长度
+    inline size_t cmd_disassemble(char* buf, size_t size, uint16_t pc, const Memory* mem, int* bytes)
+    {
+        if (size == 0)
+            return 0;
+        
+        char* p = buf;
+        const char* end = buf + size - 1;
+        
+        p = str_append(p, end, "[");
+        p = str_append_hex(p, end, pc, 4);
+        p = str_append(p, end, "]\t\t");
+        
+        uint8_t cmd = mem->get8bitData(pc);
+        if (cmd_defined(cmd))
+        {
+            p += cmd_str(p, end - p + 1, CMD_LIST[cmd], pc, mem);
+            *bytes = CMD_LIST[cmd].bytes;
+        }
+        else
+        {
+            p = str_append_int(p, end, cmd);
+            *bytes = 1;
+        }
+        
+        p = str_append(p, end, "\n");
+        *p = 0;
+        
+        return p - buf;
+    }
+    
+    // 寻址后是否需要读取源数据（STA/STX/STY只写入）
+    constexpr bool cmd_reads_src(CF cf)
+    {
+        return cf != CF_STA && cf != CF_STX && cf != CF_STY;
+    }
 
+    // 读-改-写指令（累加器寻址时不写入内存）
+    constexpr bool cmd_is_rmw(CF cf)
+    {
+        return cf == CF_INC || cf == CF_DEC || cf == CF_ASL || cf == CF_LSR || cf == CF_ROL || cf == CF_ROR;
+    }
+    
+    // 是否写入内存
+    constexpr bool cmd_writes_mem(const CmdInfo& info)
+    {
+        return info.mode != ACCUMULATOR &&
+               (info.cf == CF_STA || info.cf == CF_STX || info.cf == CF_STY || cmd_is_rmw(info.cf));
+    }
+    
+    // 是否结束基本块：跳转类指令，以及会改变中断响应的指令
+    constexpr bool cmd_ends_block(CF cf)
+    {
+        return cf == CF_BCC || cf == CF_BCS || cf == CF_BEQ || cf == CF_BMI ||
+               cf == CF_BNE || cf == CF_BPL || cf == CF_BVC || cf == CF_BVS ||
+               cf == CF_JMP || cf == CF_JSR || cf == CF_RTS || cf == CF_RTI ||
+               cf == CF_BRK || cf == CF_CLI || cf == CF_SEI || cf == CF_PLP ||
+               cf == CF_NON;
+    }
+    
+    struct AotRuntime;
+    
     // 2A03
     struct CPU {
         
+        friend struct AotRuntime;
+        
         // 标准
         // constexpr const static double StandardFrequency = 1.789773; // 标准频率 1.79Mhz
         // const static uint32_t TimePerCpuCycle = (1.0/(1024*1000*StandardFrequency)) * 1e9 ; // 每个CPU时钟为 572 ns
@@ -443,6 +591,65 @@ namespace ReNes {
         // 用于调试
         bool debug = false;
         
+        // 解释器类型，可以在同一个rom上对比两者的每条指令耗时
+        enum Interpreter {
+            INTERPRETER_GENERIC,        // 通用解释器：运行时寻址、switch分发
+            INTERPRETER_SPECIALIZED,    // 特化解释器：每条指令一个模板实例，查表分发
+            INTERPRETER_JIT,            // 特化解释器 + 热点基本块编译为本机代码（仅x86-64，只在 execBlock 中生效）
+            INTERPRETER_AOT,            // 优先使用预编译的基本块（见 aot.hpp，只在 execBlock 中生效），其余同 INTERPRETER_JIT
+        };
+        Interpreter interpreter = INTERPRETER_SPECIALIZED;
+        
+        // 指令处理函数，oper是指令中的操作数（8bit或16bit）
+        typedef void (*CmdHandler)(CPU* cpu, uint16_t oper);
+        
+        struct DecodedCmd;
+        
+        // 没有副作用的循环，结果不变的时候可以直接跳过
+        enum SpinLoop {
+            SPIN_NONE = 0,
+            SPIN_IDLE,      // 跳转到自身: JMP *
+            SPIN_POLL,      // 读取或比较RAM、$2002后跳回: LDA $2002 / BPL *-3，CMP $0B / BEQ *-2
+            SPIN_COUNT_X,   // 计数: DEX / BNE *-1，INX / BNE *-1
+            SPIN_COUNT_Y,   // 计数: DEY / BNE *-1，INY / BNE *-1
+        };
+        
+        // 超级指令处理函数：连续执行两条指令
+        typedef void (*FusedHandler)(CPU* cpu, const DecodedCmd& d);
+        
+        // 预解码的指令，PRG ROM中的指令只需要解码一次
+        struct DecodedCmd {
+            CmdHandler handler; // 为0表示未解码
+            FusedHandler fused; // 与下一条指令融合成的超级指令，为0表示不能融合
+            uint16_t oper;      // 指令中的操作数，零页/绝对寻址时就是地址
+            uint16_t oper2;     // 融合的下一条指令的操作数
+            uint8_t bytes;      // 长度
+            uint8_t cycles;     // 基础周期
+            bool ends;          // 是否结束基本块
+            bool fusedEnds;     // 融合的下一条指令是否结束基本块
+            uint8_t spin;       // 从这里开始的循环类型 SpinLoop
+            uint8_t spinCmds;   // 循环体的指令条数
+            uint8_t spinCycles; // 循环一轮的周期数
+            int8_t spinStep;    // 计数循环每轮的增量
+            uint16_t spinAddr;  // 轮询的地址
+        };
+        
+        // PRG ROM区域 $8000-$FFFF
+        const static int DECODED_CMD_COUNT = 0x10000 - PRG_ROM_LOWER_BANK_OFFSET;
+        
+        // 一个8KB PRG ROM bank的预解码、编译结果，按bank保存，切换bank之后仍然有效
+        struct DecodedBank {
+            DecodedCmd cmds[Memory::PRG_BANK_SIZE];
+            Jit::NativeBlock jitBlocks[Memory::PRG_BANK_SIZE];  // 已编译的基本块
+            uint8_t jitHeat[Memory::PRG_BANK_SIZE];             // 基本块执行次数，0xFF表示不再编译
+        };
+        
+        // 预编译的基本块
+        struct PrecompiledBlock {
+            uint16_t pc;
+            Jit::NativeBlock block;
+        };
+        
         struct __registers {
             
             // 3个特殊功能寄存器: PC寄存器(Program Counter)，SP寄存器(Stack Pointer)，P寄存器(Processor Status)
@@ -472,9 +679,25 @@ namespace ReNes {
             
         }regs;
         
+        // P寄存器。N、Z、C 标记是延迟计算的，regs.P 中的这3位无效，需要通过这里读取
+        inline bit8 status() const
+        {
+            uint8_t value = _statusValue();
+            return *(bit8*)&value;
+        }
+        
         // 错误标记
         bool error;
         
+        // 在 execBlock 中跳过没有副作用的轮询、计数循环
+        bool skipSpinLoops = true;
+        
+        // 跳过的周期数（累计）
+        long skippedCycles = 0;
+        
+        // 返回I/O寄存器 addr 的读取结果至少在之后多少个周期内保持不变（小于0表示不确定），用于跳过轮询I/O的循环
+        std::function<int(uint16_t addr)> ioStableCycles;
+        
         long execCmdLine = 0;
         
         CPU()
@@ -485,6 +708,49 @@ namespace ReNes {
             // 检查数据尺寸
             assert(1 == sizeof(regs.P));
             
+            _handlers = cmdHandlers();
+        }
+        
+        ~CPU()
+        {
+            _freeDecodedBanks();
+            free(_aotBlocks);
+        }
+        
+        // 设置预编译的基本块，只对 prgVersion 对应的PRG ROM有效，PRG ROM可以切换时不使用
+        void setPrecompiledBlocks(const PrecompiledBlock* blocks, int count, uint32_t prgVersion)
+        {
+            if (!_aotBlocks)
+                _aotBlocks = (Jit::NativeBlock*)malloc(sizeof(Jit::NativeBlock) * DECODED_CMD_COUNT);
+            memset(_aotBlocks, 0, sizeof(Jit::NativeBlock) * DECODED_CMD_COUNT);
+            
+            for (int i=0; i<count; i++)
+            {
+                if (blocks[i].pc >= PRG_ROM_LOWER_BANK_OFFSET)
+                    _aotBlocks[blocks[i].pc - PRG_ROM_LOWER_BANK_OFFSET] = blocks[i].block;
+            }
+            
+            _aotVersion = prgVersion;
+        }
+        
+        // 按操作码排列的指令处理函数表（特化解释器）
+        static const CmdHandler* cmdHandlers()
+        {
+#define RENES_CMD_HANDLER_ROW(r) \
+            &CPU::_exec<r+0x0>, &CPU::_exec<r+0x1>, &CPU::_exec<r+0x2>, &CPU::_exec<r+0x3>, \
+            &CPU::_exec<r+0x4>, &CPU::_exec<r+0x5>, &CPU::_exec<r+0x6>, &CPU::_exec<r+0x7>, \
+            &CPU::_exec<r+0x8>, &CPU::_exec<r+0x9>, &CPU::_exec<r+0xA>, &CPU::_exec<r+0xB>, \
+            &CPU::_exec<r+0xC>, &CPU::_exec<r+0xD>, &CPU::_exec<r+0xE>, &CPU::_exec<r+0xF>
+            
+            static const CmdHandler handlers[256] = {
+                RENES_CMD_HANDLER_ROW(0x00), RENES_CMD_HANDLER_ROW(0x10), RENES_CMD_HANDLER_ROW(0x20), RENES_CMD_HANDLER_ROW(0x30),
+                RENES_CMD_HANDLER_ROW(0x40), RENES_CMD_HANDLER_ROW(0x50), RENES_CMD_HANDLER_ROW(0x60), RENES_CMD_HANDLER_ROW(0x70),
+                RENES_CMD_HANDLER_ROW(0x80), RENES_CMD_HANDLER_ROW(0x90), RENES_CMD_HANDLER_ROW(0xA0), RENES_CMD_HANDLER_ROW(0xB0),
+                RENES_CMD_HANDLER_ROW(0xC0), RENES_CMD_HANDLER_ROW(0xD0), RENES_CMD_HANDLER_ROW(0xE0), RENES_CMD_HANDLER_ROW(0xF0),
+            };
+#undef RENES_CMD_HANDLER_ROW
+            
+            return handlers;
         }
         
         // 初始化，映射内存
@@ -547,11 +813,20 @@ namespace ReNes {
             if (hasInterrupts) _currentInterruptType = type;
         }
         
+        // 设置IRQ信号线（mapper等硬件使用），电平触发：拉低期间中断禁止标记清除后仍然会产生中断，直到硬件确认后释放
+        void setIRQLine(bool active)
+        {
+            _irqLine = active;
+        }
+        
         // 处理中断信号
         void process_interrupts()
         {
             RENES_REGS
             
+            if (_irqLine && _currentInterruptType == InterruptTypeNone)
+                interrupts(InterruptTypeIRQs);
+            
             // 处理中断
             if (_currentInterruptType != InterruptTypeNone)
             {
@@ -585,13 +860,13 @@ namespace ReNes {
                         {
                             case InterruptTypeBreak:
                             {
-                                push(SR | 0x30); // 4,5 = 1
+                                push(_statusValue() | 0x30); // 4,5 = 1
                                 break;
                             }
                             case InterruptTypeNMI:
                             case InterruptTypeIRQs:
                             {
-                                push(SR | 0x10); // 4 = 1
+                                push(_statusValue() | 0x10); // 4 = 1
                                 break;
                             }
                             default:
@@ -622,40 +897,59 @@ namespace ReNes {
             // 检查中断和处理中断
             process_interrupts();
             
+            // ROM中的指令直接使用预解码结果，跳过取指和解码
+            if (interpreter != INTERPRETER_GENERIC && !debug && regs.PC >= PRG_ROM_LOWER_BANK_OFFSET)
+            {
+                const DecodedCmd& d = _decodedCmd(regs.PC);
+                if (d.handler)
+                {
+                    d.handler(this, d.oper);
+                    
+                    error = _mem->error;
+                    execCmdLine ++;
+                    
+                    return d.cycles;
+                }
+            }
+            
             // 从内存里面取出一条8bit指令，将PC移动到下一个内存地址
             uint8_t cmd = get8bitData(regs.PC);
             
             log("[%ld][%04X] cmd: %x => ", execCmdLine, regs.PC, cmd);
             
-#ifdef RENES_DEBUG
-            if (!RENES_SET_FIND(CMD_LIST, cmd))
+            const CmdInfo& info = CMD_LIST[cmd];
+            
+            if (!cmd_defined(cmd))
             {
                 log("未知的指令！");
                 error = true;
                 return 0;
             }
-#endif
-            
-            const auto& info = CMD_LIST.at(cmd);
             
             if (this->debug)
             {
-                auto str = cmd_str(info, regs.PC, _mem);
-                log("%s\n", str.c_str());
+                char str[CMD_STR_MAX];
+                cmd_str(str, sizeof(str), info, regs.PC, _mem);
+                log("%s\n", str);
             }
             
-            _runCmd(info);
+            if (interpreter != INTERPRETER_GENERIC)
+            {
+                uint16_t oper = info.bytes == 3 ? get16bitData(regs.PC + 1) : get8bitData(regs.PC + 1);
+                _handlers[cmd](this, oper);
+            }
+            else
+            {
+                _runCmd(info);
+            }
             
             // 检查内存错误
             error = _mem->error;
 
 #ifdef RENES_DEBUG
-            log("A: %d X: %d Y: %d P: %d - ", regs.A, regs.X, regs.Y, regs.P);
-            for (int i=0; i<8; i++)
-            {
-                log("%d ", regs.P.get(i));
-            }
-            log("\n");
+            uint8_t P = _statusValue();
+            log("A: %d X: %d Y: %d P: %d - %d %d %d %d %d %d %d %d \n", regs.A, regs.X, regs.Y, P,
+                P & 1, (P >> 1) & 1, (P >> 2) & 1, (P >> 3) & 1, (P >> 4) & 1, (P >> 5) & 1, (P >> 6) & 1, (P >> 7) & 1);
 #endif
             
             execCmdLine ++;
@@ -663,8 +957,131 @@ namespace ReNes {
             return info.cycles;
         }
         
+        // 以基本块为单位执行PRG ROM中的指令，直到遇到跳转类指令或者周期数达到 budget，
+        // 返回执行的cpu周期数。块内不会检查中断，调用者需要保证 budget 之前没有新的中断事件；
+        // 块内访问I/O时，可以通过 takeUnsyncedCycles() 取得还没有同步给PPU的周期数
+        int execBlock(int budget)
+        {
+            _blockCycles = 0;
+            _syncedCycles = 0;
+            
+            if (error)
+                return 0;
+            
+            process_interrupts();
+            
+            // 调试和通用解释器，以及RAM里的指令，仍然逐条执行
+            if (interpreter == INTERPRETER_GENERIC || debug || regs.PC < PRG_ROM_LOWER_BANK_OFFSET)
+            {
+                _blockCycles = exec();
+                return _blockCycles;
+            }
+            
+            if (skipSpinLoops)
+            {
+                _skipSpinLoop(budget);
+                
+                if (_blockCycles >= budget || regs.PC < PRG_ROM_LOWER_BANK_OFFSET || _mem->error)
+                {
+                    error = _mem->error;
+                    return _blockCycles;
+                }
+            }
+            
+            // 预编译的基本块
+            if (interpreter == INTERPRETER_AOT && _aotBlocks && _aotVersion == _mem->prgVersion() && !_mem->prgSwitchable())
+            {
+                Jit::NativeBlock block = _aotBlocks[regs.PC - PRG_ROM_LOWER_BANK_OFFSET];
+                if (block)
+                {
+                    execCmdLine += block(this, &_blockCycles, budget);
+                    error = _mem->error;
+                    
+                    return _blockCycles;
+                }
+            }
+            
+            // 热点基本块使用编译后的本机代码
+            if (interpreter == INTERPRETER_JIT || interpreter == INTERPRETER_AOT)
+            {
+                Jit::NativeBlock block = _jitBlock(regs.PC);
+                if (block)
+                {
+                    execCmdLine += block(this, &_blockCycles, budget);
+                    error = _mem->error;
+                    
+                    return _blockCycles;
+                }
+            }
+            
+            while (true)
+            {
+                const DecodedCmd& d = _decodedCmd(regs.PC);
+                if (!d.handler)
+                {
+                    // 无法预解码的指令交给 exec 处理（包括报告未定义指令，这时不能再用 _mem->error 覆盖 error）
+                    if (_blockCycles == 0)
+                    {
+                        _blockCycles = exec();
+                        return _blockCycles;
+                    }
+                    break;
+                }
+                
+                // 第一条指令执行完还没有用完 budget 时才使用超级指令，保证与逐条执行时的结束位置一致
+                if (d.fused && _blockCycles + d.cycles < budget)
+                {
+                    d.fused(this, d);
+                    execCmdLine += 2;
+                    
+                    if (d.fusedEnds)
+                        break;
+                }
+                else
+                {
+                    d.handler(this, d.oper);
+                    _blockCycles += d.cycles;
+                    execCmdLine ++;
+                    
+                    if (d.ends)
+                        break;
+                }
+                
+                if (_blockCycles >= budget || regs.PC < PRG_ROM_LOWER_BANK_OFFSET || _mem->error)
+                    break;
+            }
+            
+            error = _mem->error;
+            
+            return _blockCycles;
+        }
+        
+        // 当前块里已执行、但还没有同步给PPU的周期数，取出后视为已同步
+        inline
+        int takeUnsyncedCycles()
+        {
+            int cycles = _blockCycles - _syncedCycles;
+            _syncedCycles = _blockCycles;
+            return cycles;
+        }
+        
     private:
         
+        //////////////////////////////////////////////////////////////////
+        // 标记位
+        // N、Z 只保存最后的结果（BIT指令的 N、Z 来自不同的值，所以分开保存），C 单独保存，
+        // 需要的时候再计算，省去每条指令对 regs.P 的读-改-写
+        unsigned int _n = 0;    // bit7 为 N
+        unsigned int _z = 1;    // 为0时 Z = 1
+        unsigned int _c = 0;    // C
+        
+        inline uint8_t _statusValue() const
+        {
+            uint8_t value = *(const uint8_t*)&regs.P & ~0x83;
+            value |= (_n & 0x80) | (_z == 0 ? 0x02 : 0) | (_c ? 0x01 : 0);
+            return value;
+        }
+        
         //////////////////////////////////////////////////////////////////
         // 操作函数
         inline void SET_SR(uint8_t src)
@@ -672,40 +1089,172 @@ namespace ReNes {
             // 忽略4/5位
             src &= ~0x30;
             regs.P = *(bit8*)&src;
+            
+            _n = src;
+            _z = !(src & 0x02);
+            _c = src & 0x01;
         };
-        inline void SET_CARRY(int src) { regs.P.set(__registers::C, src != 0 ? 1 : 0); };
+        inline void SET_CARRY(int src) { _c = src != 0; };
         inline void SET_DECIMAL(int src) { regs.P.set(__registers::D, src != 0 ? 1 : 0); };
         inline void SET_INTERRUPT(int src) { regs.P.set(__registers::I, src != 0 ? 1 : 0); };
-        inline void SET_SIGN(int8_t src) { regs.P.set(__registers::N, src & 0x80 ? 1 : 0); };
-        inline void SET_ZERO(int8_t src) { regs.P.set(__registers::Z, src == 0 ? 1 : 0); };
+        inline void SET_SIGN(int8_t src) { _n = (uint8_t)src; };
+        inline void SET_ZERO(int8_t src) { _z = (uint8_t)src; };
         inline void SET_OVERFLOW(bool src) { regs.P.set(__registers::V, src); };
         inline void STORE(uint16_t addr, int8_t src) { write8bitData(addr, src); };
         inline uint16_t REL_ADDR(uint16_t addr, int8_t src) const { return addr + src; };
-        inline bool IF_CARRY() const { return regs.P.get(__registers::C); };
+        inline bool IF_CARRY() const { return _c; };
         inline bool IF_DECIMAL() const { return regs.P.get(__registers::D); };
-        inline bool IF_ZERO() const { return regs.P.get(__registers::Z); };
-        inline bool IF_SIGN() const { return regs.P.get(__registers::N); };
+        inline bool IF_ZERO() const { return _z == 0; };
+        inline bool IF_SIGN() const { return _n & 0x80; };
         inline bool IF_OVERFLOW() const { return regs.P.get(__registers::V); };
         
         inline void SET_BREAK(int src) { regs.P.set(__registers::B, src != 0 ? 1 : 0); };
         
-        //////////////////////////////////////////////////////////////////
+        //////////////////////////////////////////////////////////////////
+        
+        inline
+        void _runCmd(const CmdInfo& info)
+        {
+            // 得到 dst、src、address
+            DST dst = DST_NONE;
+            unsigned int src = 0;
+            uint16_t address = 0;
+            
+            // 发生错误的话（可能由部分监听器阻止）, 这里检测实现错误
+            if (!_addressing(info, &dst, &src, &address))
+                return;
+            
+            _operate(info.cf, dst, src, address);
+        }
+        
+        // 特化解释器：每条指令是一个模板实例，寻址模式、指令标记、长度都是编译期常量，
+        // 编译器可以把寻址计算、标记更新和写回目标折叠成直线代码
+        template <uint8_t OP>
+        static void _exec(CPU* cpu, uint16_t oper)
+        {
+            cpu->_execSpecialized<CMD_LIST[OP].cf, CMD_LIST[OP].mode, CMD_LIST[OP].bytes>(oper);
+        }
+        
+        // 超级指令：两条指令连续执行，中间更新块内周期数，使第二条指令访问I/O时PPU能同步到正确的位置
+        template <uint8_t OP1, uint8_t OP2>
+        static void _fused(CPU* cpu, const DecodedCmd& d)
+        {
+            cpu->_execSpecialized<CMD_LIST[OP1].cf, CMD_LIST[OP1].mode, CMD_LIST[OP1].bytes>(d.oper);
+            cpu->_blockCycles += CMD_LIST[OP1].cycles;
+            cpu->_execSpecialized<CMD_LIST[OP2].cf, CMD_LIST[OP2].mode, CMD_LIST[OP2].bytes>(d.oper2);
+            cpu->_blockCycles += CMD_LIST[OP2].cycles;
+        }
+        
+        struct FusedCmd {
+            uint8_t cmd1;
+            uint8_t cmd2;
+            FusedHandler handler;
+        };
+        
+        // 可以融合的指令对，来自常见的 搬运数据、计数循环、轮询等待 写法
+        static FusedHandler _fusedHandler(uint8_t cmd1, uint8_t cmd2)
+        {
+#define RENES_FUSED_CMD(a, b) {a, b, &CPU::_fused<a, b>}
+            static const FusedCmd list[] = {
+                // LDA + STA
+                RENES_FUSED_CMD(0xA9, 0x85), RENES_FUSED_CMD(0xA9, 0x8D), RENES_FUSED_CMD(0xA9, 0x9D),
+                RENES_FUSED_CMD(0xA5, 0x85), RENES_FUSED_CMD(0xA5, 0x8D),
+                RENES_FUSED_CMD(0xAD, 0x85), RENES_FUSED_CMD(0xAD, 0x8D),
+                RENES_FUSED_CMD(0xBD, 0x8D), RENES_FUSED_CMD(0xBD, 0x9D),
+                RENES_FUSED_CMD(0xB9, 0x99), RENES_FUSED_CMD(0xB1, 0x8D),
+                // DEX/DEY/INX/INY/INC + 分支
+                RENES_FUSED_CMD(0xCA, 0xD0), RENES_FUSED_CMD(0xCA, 0x10),
+                RENES_FUSED_CMD(0x88, 0xD0), RENES_FUSED_CMD(0x88, 0x10),
+                RENES_FUSED_CMD(0xE8, 0xD0), RENES_FUSED_CMD(0xC8, 0xD0),
+                RENES_FUSED_CMD(0xE6, 0xD0), RENES_FUSED_CMD(0xC6, 0xD0),
+                // CMP/CPX/CPY + 分支
+                RENES_FUSED_CMD(0xC9, 0xF0), RENES_FUSED_CMD(0xC9, 0xD0), RENES_FUSED_CMD(0xC9, 0x90), RENES_FUSED_CMD(0xC9, 0xB0),
+                RENES_FUSED_CMD(0xC5, 0xF0), RENES_FUSED_CMD(0xC5, 0xD0),
+                RENES_FUSED_CMD(0xE0, 0xF0), RENES_FUSED_CMD(0xE0, 0xD0),
+                RENES_FUSED_CMD(0xC0, 0xF0), RENES_FUSED_CMD(0xC0, 0xD0),
+                // BIT/LDA + 分支（轮询）
+                RENES_FUSED_CMD(0x2C, 0x10), RENES_FUSED_CMD(0x2C, 0x30), RENES_FUSED_CMD(0x2C, 0x50), RENES_FUSED_CMD(0x2C, 0x70),
+                RENES_FUSED_CMD(0xAD, 0x10), RENES_FUSED_CMD(0xAD, 0x30),
+                RENES_FUSED_CMD(0xA5, 0xF0), RENES_FUSED_CMD(0xA5, 0xD0),
+            };
+#undef RENES_FUSED_CMD
+            
+            for (const FusedCmd& f : list)
+            {
+                if (f.cmd1 == cmd1 && f.cmd2 == cmd2)
+                    return f.handler;
+            }
+            
+            return 0;
+        }
         
-        inline
-        void _runCmd(const CmdInfo& info)
+        template <CF cf, AddressingMode mode, int bytes>
+        RENES_FORCE_INLINE
+        void _execSpecialized(uint16_t oper)
         {
             RENES_REGS
             
-            // 得到 dst、src、address
             DST dst = DST_NONE;
             unsigned int src = 0;
             uint16_t address = 0;
             
-            // 发生错误的话（可能由部分监听器阻止）, 这里检测实现错误
-            if (!_addressing(info, &dst, &src, &address))
-                return;
+            switch (mode)
+            {
+                case IMPLIED:
+                    break;
+                case ACCUMULATOR:
+                {
+                    src = AC;
+                    dst = DST_REGS_A;
+                    break;
+                }
+                case RELATIVE:
+                case IMMIDIATE:
+                {
+                    // 操作数就在指令里，不需要再访问内存
+                    src = oper & 0xff;
+                    address = PC + 1;
+                    dst = DST_M;
+                    break;
+                }
+                default:
+                {
+                    address = _effectiveAddress(mode, bytes == 2 ? (oper & 0xff) : oper);
+                    
+                    if (cmd_reads_src(cf))
+                    {
+                        bool valid = true;
+                        src = (uint8_t)read8bitData(address, &valid);
+                        
+                        // 与 _addressing 一致：读取被监听器阻止时，只移动PC
+                        if (!valid)
+                        {
+                            PC += bytes;
+                            return;
+                        }
+                    }
+                    
+                    dst = DST_M;
+                    break;
+                }
+            }
             
-            switch(info.cf)
+            PC += bytes;
+            
+            _operate(cf, dst, src, address);
+        }
+        
+        // 执行指令操作，cf为常量时（特化解释器）整个switch会被折叠
+        RENES_FORCE_INLINE
+        void _operate(CF cf, DST dst, unsigned int src, uint16_t address)
+        {
+            RENES_REGS
+            
+            // 读-改-写指令先写回原值，下一个周期再写入新值。mapper寄存器能看到两次写入（MMC1依靠写回的原值复位）
+            if (cmd_is_rmw(cf) && dst == DST_M && address >= PRG_ROM_LOWER_BANK_OFFSET)
+                write8bitData(address, src);
+            
+            switch(cf)
             {
                 case CF_NON:
                 {
@@ -1030,8 +1579,7 @@ namespace ReNes {
                 }
                 case CF_PHP:
                 {
-                    // push(*(uint8_t*)&SR);
-                    src = SR | 0x30; // P入栈需要设置副本第4、5bit为1，而自身不变(https://wiki.nesdev.com/w/index.php/CPU_status_flag_behavior)
+                    src = _statusValue() | 0x30; // P入栈需要设置副本第4、5bit为1，而自身不变(https://wiki.nesdev.com/w/index.php/CPU_status_flag_behavior)
                     push(src);
                     break;
                 }
@@ -1263,12 +1811,8 @@ namespace ReNes {
                     // 先得到地址，该地址可用于读写访问
                     *address = memoryAddressingByMode(mode);
                     
-                    // 寄存器 存储到 地址
-                    const static CF _noSrcAccess[] = {
-                        CF_STA, CF_STX, CF_STY
-                    };
-                    
-                    if (!RENES_ARRAY_FIND(_noSrcAccess, info.cf))
+                    // 寄存器 存储到 地址，不需要读取源数据
+                    if (cmd_reads_src(info.cf))
                     {
                         *src = (uint8_t)read8bitData(*address, &valid);
                     }
@@ -1332,62 +1876,48 @@ namespace ReNes {
         
         
 
-        // 内存寻址，得到操作数所在的地址
-        inline
-        uint16_t memoryAddressingByMode(AddressingMode mode) const
+        // 由操作数计算有效地址（不含立即数/相对寻址），oper是指令中的8bit或16bit操作数
+        RENES_FORCE_INLINE
+        uint16_t _effectiveAddress(AddressingMode mode, uint16_t oper) const
         {
-            // PC: cmd (8bit)
-            // PC+1: 数据
-            uint16_t dataAddr = regs.PC + 1; // 操作数位置 = PC + 1
-            
-            // 操作数实际存在的地址
-            uint16_t addr;
-            bool data16bit = false;
+            uint16_t addr = 0;
             
             switch (mode)
             {
-                case RELATIVE:      // 相对寻址  [8bit] 跳转
-                case IMMIDIATE:     // 立即数寻址 [8bit] 直接
-                {
-                    addr = dataAddr;
-                    break;
-                }
                 case ZERO_PAGE:
                 {
-                    addr = get8bitData(dataAddr);
+                    addr = oper;
                     break;
                 }
                 case ZERO_PAGE_X:
                 {
-                    addr = (get8bitData(dataAddr) + regs.X) % 0x100; // [0, 255] 循环
+                    addr = (oper + regs.X) % 0x100; // [0, 255] 循环
                     break;
                 }
                 case ZERO_PAGE_Y:
                 {
-                    addr = (get8bitData(dataAddr) + regs.Y) % 0x100;
+                    addr = (oper + regs.Y) % 0x100;
                     break;
                 }
                 case INDEXED_ABSOLUTE:
                 {
-                    addr = get16bitData(dataAddr);
+                    addr = oper;
                     break;
                 }
                 case INDEXED_ABSOLUTE_X:
                 {
-                    addr = get16bitData(dataAddr) + regs.X;
+                    addr = oper + regs.X;
                     break;
                 }
                 case INDEXED_ABSOLUTE_Y:
                 {
-                    addr = get16bitData(dataAddr) + regs.Y;
+                    addr = oper + regs.Y;
                     break;
                 }
                 case INDIRECT:
                 {
-                    auto oper = get16bitData(dataAddr);
-                    
-                    // 6502 JMP Indirect bug
-                    if ((oper & 0xff) == 0xff && get8bitData(regs.PC) == 0x6C) // 低字节是0xFF，高位就从当前页读取
+                    // 6502 JMP Indirect bug (只有JMP使用间接寻址)
+                    if ((oper & 0xff) == 0xff) // 低字节是0xFF，高位就从当前页读取
                     {
                         addr = get8bitData(oper) | (get8bitData(oper-0xff) << 8);
                     }
@@ -1400,12 +1930,12 @@ namespace ReNes {
                 }
                 case INDIRECT_X_INDEXED:
                 {
-                    addr = get16bitData((get8bitData(dataAddr) + regs.X) % 0x100);
+                    addr = get16bitData((oper + regs.X) % 0x100);
                     break;
                 }
                 case INDIRECT_INDEXED_Y:
                 {
-                    addr = get16bitData(get8bitData(dataAddr)) + regs.Y;
+                    addr = get16bitData(oper) + regs.Y;
                     break;
                 }
                 default:
@@ -1413,6 +1943,44 @@ namespace ReNes {
                     break;
             }
             
+            return addr;
+        }
+        
+        // 内存寻址，得到操作数所在的地址
+        inline
+        uint16_t memoryAddressingByMode(AddressingMode mode) const
+        {
+            // PC: cmd (8bit)
+            // PC+1: 数据
+            uint16_t dataAddr = regs.PC + 1; // 操作数位置 = PC + 1
+            
+            // 操作数实际存在的地址
+            uint16_t addr;
+            bool data16bit = false;
+            
+            switch (mode)
+            {
+                case RELATIVE:      // 相对寻址  [8bit] 跳转
+                case IMMIDIATE:     // 立即数寻址 [8bit] 直接
+                {
+                    addr = dataAddr;
+                    break;
+                }
+                case INDEXED_ABSOLUTE:
+                case INDEXED_ABSOLUTE_X:
+                case INDEXED_ABSOLUTE_Y:
+                case INDIRECT:
+                {
+                    addr = _effectiveAddress(mode, get16bitData(dataAddr));
+                    break;
+                }
+                default:
+                {
+                    addr = _effectiveAddress(mode, get8bitData(dataAddr));
+                    break;
+                }
+            }
+            
             if (dataAddr == addr)
             {
                 int dd;
@@ -1431,6 +1999,347 @@ namespace ReNes {
             return addr;
         }
         
+        // 释放所有bank的预解码结果
+        void _freeDecodedBanks()
+        {
+            for (int i=0; i<_decodedBankCount; i++)
+                free(_decodedBanks[i]);
+            
+            free(_decodedBanks);
+            _decodedBanks = 0;
+            _decodedBankCount = 0;
+        }
+        
+        // pc 所在bank槽当前映射的bank的预解码结果
+        inline
+        DecodedBank* _decodedBank(uint16_t pc)
+        {
+            if (_decodedMapVersion != _mem->prgMapVersion())
+                _updateDecodedSlots();
+            
+            return _decodedSlots[(pc >> 13) & (Memory::PRG_BANK_SLOT_COUNT - 1)];
+        }
+        
+        // bank映射变化后，更新每个bank槽对应的预解码结果，第一次使用的bank在这里申请
+        void _updateDecodedSlots()
+        {
+            // 载入新的PRG ROM后清空缓存
+            if (_decodedVersion != _mem->prgVersion() || !_decodedBanks)
+            {
+                _freeDecodedBanks();
+                
+                // 没有载入PRG ROM时，$8000-$FFFF 按4个bank处理
+                _decodedBankCount = NES_MAX(_mem->prgBankCount(), (int)Memory::PRG_BANK_SLOT_COUNT);
+                _decodedBanks = (DecodedBank**)malloc(sizeof(DecodedBank*) * _decodedBankCount);
+                memset(_decodedBanks, 0, sizeof(DecodedBank*) * _decodedBankCount);
+                
+                _decodedVersion = _mem->prgVersion();
+                
+                // 之前编译的代码不再被引用，下次编译时清空
+                _jitDirty = true;
+            }
+            
+            for (int i=0; i<Memory::PRG_BANK_SLOT_COUNT; i++)
+            {
+                DecodedBank*& bank = _decodedBanks[_mem->prgBank(PRG_ROM_LOWER_BANK_OFFSET + i * Memory::PRG_BANK_SIZE)];
+                if (!bank)
+                {
+                    bank = (DecodedBank*)malloc(sizeof(DecodedBank));
+                    memset(bank, 0, sizeof(DecodedBank));
+                }
+                _decodedSlots[i] = bank;
+            }
+            
+            _decodedMapVersion = _mem->prgMapVersion();
+        }
+        
+        // [pc, pc + bytes) 是否位于同一个8KB的bank槽，跨越bank槽的指令（以及跨越$FFFF的指令）不缓存
+        inline
+        static bool _inSameBankSlot(int pc, int bytes)
+        {
+            return (pc >> 13) == ((pc + bytes - 1) >> 13);
+        }
+        
+        // 写入指令是否可能写到 $8000-$FFFF（mapper寄存器）
+        inline
+        static bool _mayWriteRom(const CmdInfo& info, uint16_t oper)
+        {
+            if (!cmd_writes_mem(info))
+                return false;
+            
+            switch (info.mode)
+            {
+                case INDEXED_ABSOLUTE:
+                    return oper >= PRG_ROM_LOWER_BANK_OFFSET;
+                case INDEXED_ABSOLUTE_X:
+                case INDEXED_ABSOLUTE_Y:
+                    return oper + 0xFF >= PRG_ROM_LOWER_BANK_OFFSET;
+                case INDIRECT_X_INDEXED:
+                case INDIRECT_INDEXED_Y:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        
+        // 得到预解码的指令，PC必须位于PRG ROM
+        inline
+        const DecodedCmd& _decodedCmd(uint16_t pc)
+        {
+            DecodedCmd& d = _decodedBank(pc)->cmds[pc & (Memory::PRG_BANK_SIZE - 1)];
+            if (d.handler == 0)
+            {
+                uint8_t cmd = get8bitData(pc);
+                const CmdInfo& info = CMD_LIST[cmd];
+                
+                // 未定义的指令，以及跨越bank槽的指令，不缓存
+                if (cmd_defined(cmd) && _inSameBankSlot(pc, info.bytes))
+                {
+                    d.oper = info.bytes == 3 ? get16bitData(pc + 1) : get8bitData(pc + 1);
+                    d.bytes = info.bytes;
+                    d.cycles = info.cycles;
+                    d.ends = cmd_ends_block(info.cf);
+                    d.fused = 0;
+                    
+                    // 可能切换PRG ROM bank的写入结束基本块，之后的指令需要按新的映射取指
+                    if (_mem->prgSwitchable() && _mayWriteRom(info, d.oper))
+                        d.ends = true;
+                    
+                    // 与下一条指令融合（需要在同一个bank槽中）
+                    int next = pc + info.bytes;
+                    if (!d.ends && _inSameBankSlot(pc, info.bytes + 1))
+                    {
+                        uint8_t cmd2 = get8bitData(next);
+                        const CmdInfo& info2 = CMD_LIST[cmd2];
+                        
+                        if (_inSameBankSlot(pc, info.bytes + info2.bytes))
+                        {
+                            d.fused = _fusedHandler(cmd, cmd2);
+                            d.oper2 = info2.bytes == 3 ? get16bitData(next + 1) : get8bitData(next + 1);
+                            d.fusedEnds = cmd_ends_block(info2.cf) || (_mem->prgSwitchable() && _mayWriteRom(info2, d.oper2));
+                        }
+                    }
+                    
+                    _classifySpinLoop(pc, d);
+                    
+                    d.handler = _handlers[cmd];
+                }
+            }
+            
+            return d;
+        }
+        
+        inline
+        static bool _isBranch(uint8_t cmd)
+        {
+            return (cmd & 0x1F) == 0x10;
+        }
+        
+        // 识别从pc开始的没有副作用的循环
+        void _classifySpinLoop(uint16_t pc, DecodedCmd& d) const
+        {
+            d.spin = SPIN_NONE;
+            
+            // 循环体需要在同一个bank槽中
+            if (!_inSameBankSlot(pc, 8))
+                return;
+            
+            uint8_t cmd = get8bitData(pc);
+            
+            // 跳转到自身
+            if ((cmd == 0x4C && get16bitData(pc + 1) == pc) || (_isBranch(cmd) && get8bitData(pc + 1) == 0xFE))
+            {
+                d.spin = SPIN_IDLE;
+                d.spinCmds = 1;
+                d.spinCycles = CMD_LIST[cmd].cycles;
+                return;
+            }
+            
+            // DEX、INX、DEY、INY + BNE *-1
+            if ((cmd == 0xCA || cmd == 0xE8 || cmd == 0x88 || cmd == 0xC8) && get8bitData(pc + 1) == 0xD0 && get8bitData(pc + 2) == 0xFD)
+            {
+                d.spin = (cmd == 0xCA || cmd == 0xE8) ? SPIN_COUNT_X : SPIN_COUNT_Y;
+                d.spinStep = (cmd == 0xCA || cmd == 0x88) ? -1 : 1;
+                d.spinCmds = 2;
+                d.spinCycles = CMD_LIST[cmd].cycles + CMD_LIST[0xD0].cycles;
+                return;
+            }
+            
+            // LDA/LDX/LDY/BIT/CMP/CPX/CPY 零页、绝对寻址
+            const uint8_t READ_CMDS[] = {0xA5, 0xAD, 0xA6, 0xAE, 0xA4, 0xAC, 0x24, 0x2C, 0xC5, 0xCD, 0xE4, 0xEC, 0xC4, 0xCC};
+            if (!RENES_ARRAY_FIND(READ_CMDS, cmd))
+                return;
+            
+            uint16_t addr = CMD_LIST[cmd].bytes == 3 ? get16bitData(pc + 1) : get8bitData(pc + 1);
+            if (addr >= 0x2000 && addr != 0x2002)
+                return;
+            
+            int cur = pc + CMD_LIST[cmd].bytes;
+            int cmds = 1;
+            int cycles = CMD_LIST[cmd].cycles;
+            
+            // 可选的 CMP/CPX/CPY/AND 立即数、零页寻址
+            const uint8_t COMPARE_CMDS[] = {0xC9, 0xC5, 0xE0, 0xE4, 0xC0, 0xC4, 0x29, 0x25};
+            uint8_t cmd2 = get8bitData(cur);
+            if (RENES_ARRAY_FIND(COMPARE_CMDS, cmd2))
+            {
+                cur += CMD_LIST[cmd2].bytes;
+                cmds ++;
+                cycles += CMD_LIST[cmd2].cycles;
+            }
+            
+            // 跳回起始地址
+            uint8_t branch = get8bitData(cur);
+            if (!_isBranch(branch) || (uint16_t)(cur + 2 + (int8_t)get8bitData(cur + 1)) != pc)
+                return;
+            
+            d.spin = SPIN_POLL;
+            d.spinCmds = cmds + 1;
+            d.spinCycles = cycles + CMD_LIST[branch].cycles;
+            d.spinAddr = addr;
+        }
+        
+        // 跳过没有副作用的循环：先正常执行一轮，确认会继续循环后，直接跳过之后结果不变的轮数，
+        // 周期数和状态与逐条执行完全相同
+        void _skipSpinLoop(int budget)
+        {
+            const uint16_t start = regs.PC;
+            const DecodedCmd& d = _decodedCmd(start);
+            if (!d.handler || d.spin == SPIN_NONE || _blockCycles + d.spinCycles >= budget)
+                return;
+            
+            for (int i=0; i<d.spinCmds; i++)
+            {
+                const DecodedCmd& cmd = _decodedCmd(regs.PC);
+                if (!cmd.handler)
+                    return;
+                
+                cmd.handler(this, cmd.oper);
+                _blockCycles += cmd.cycles;
+                execCmdLine ++;
+            }
+            
+            if (regs.PC != start || _mem->error)
+                return;
+            
+            // 在 budget 之前结束的轮数
+            int count = (budget - 1 - _blockCycles) / d.spinCycles;
+            
+            switch (d.spin)
+            {
+                case SPIN_POLL:
+                {
+                    // 轮询I/O时，每轮开始的读取结果都要保持不变
+                    if (d.spinAddr >= 0x2000)
+                    {
+                        int stable = ioStableCycles ? ioStableCycles(d.spinAddr) : -1;
+                        count = stable < 0 ? 0 : NES_MIN(count, stable / d.spinCycles + 1);
+                    }
+                    break;
+                }
+                case SPIN_COUNT_X:
+                case SPIN_COUNT_Y:
+                {
+                    // 保留计数到0的最后一轮
+                    uint8_t& reg = d.spin == SPIN_COUNT_X ? regs.X : regs.Y;
+                    int rounds = d.spinStep < 0 ? reg : 0x100 - reg;
+                    count = NES_MIN(count, rounds - 1);
+                    
+                    if (count > 0)
+                    {
+                        reg += d.spinStep * count;
+                        SET_SIGN(reg);
+                        SET_ZERO(reg);
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            
+            if (count <= 0)
+                return;
+            
+            _blockCycles += count * d.spinCycles;
+            execCmdLine += count * d.spinCmds;
+            skippedCycles += count * d.spinCycles;
+        }
+        
+        // 基本块执行多少次之后编译
+        const static int JIT_HOT_COUNT = 8;
+        
+        // 得到pc处已编译的基本块，执行次数达到 JIT_HOT_COUNT 时编译
+        Jit::NativeBlock _jitBlock(uint16_t pc)
+        {
+            if (!_jit.available())
+                return 0;
+            
+            DecodedBank* bank = _decodedBank(pc);
+            
+            // 载入新的PRG ROM或者代码缓存用完后，清空所有编译结果（不能在编译的代码执行过程中清空）
+            if (_jitDirty)
+            {
+                _jit.reset();
+                for (int i=0; i<_decodedBankCount; i++)
+                {
+                    if (_decodedBanks[i])
+                    {
+                        memset(_decodedBanks[i]->jitBlocks, 0, sizeof(_decodedBanks[i]->jitBlocks));
+                        memset(_decodedBanks[i]->jitHeat, 0, sizeof(_decodedBanks[i]->jitHeat));
+                    }
+                }
+                _jitDirty = false;
+            }
+            
+            int index = pc & (Memory::PRG_BANK_SIZE - 1);
+            if (bank->jitBlocks[index])
+                return bank->jitBlocks[index];
+            
+            uint8_t& heat = bank->jitHeat[index];
+            if (heat == 0xFF)
+                return 0;
+            
+            if (++heat < JIT_HOT_COUNT)
+                return 0;
+            
+            // 编译失败（或者不能编译）的块不再尝试
+            heat = 0xFF;
+            
+            // 代码缓存用完了，下次进入时清空
+            if (!_jit.hasSpace(Jit::BLOCK_CMD_MAX))
+            {
+                _jitDirty = true;
+                return 0;
+            }
+            
+            // 收集基本块中的指令（同一个bank槽中）
+            JitCmd cmds[Jit::BLOCK_CMD_MAX];
+            int count = 0;
+            int cur = pc;
+            while (count < Jit::BLOCK_CMD_MAX && (cur >> 13) == (pc >> 13))
+            {
+                const DecodedCmd& d = _decodedCmd(cur);
+                if (!d.handler)
+                    break;
+                
+                cmds[count].handler = (uintptr_t)d.handler;
+                cmds[count].oper = d.oper;
+                cmds[count].cycles = d.cycles;
+                cmds[count].jump = get8bitData(cur) == 0x4C;
+                count ++;
+                
+                if (d.ends)
+                    break;
+                
+                cur += d.bytes;
+            }
+            
+            int32_t pcOffset = (int32_t)((uint8_t*)&regs.PC - (uint8_t*)this);
+            bank->jitBlocks[index] = _jit.compile(pc, cmds, count, pcOffset);
+            
+            return bank->jitBlocks[index];
+        }
+        
         // 封装内存读写
         inline
         void write8bitData(uint16_t addr, uint8_t value)
@@ -1475,6 +2384,24 @@ namespace ReNes {
 
         Memory* _mem;
         InterruptType _currentInterruptType;
+        bool _irqLine = false;
+        
+        const CmdHandler* _handlers;
+        
+        DecodedBank** _decodedBanks = 0; // 按PRG ROM bank保存的预解码缓存
+        int _decodedBankCount = 0;
+        DecodedBank* _decodedSlots[Memory::PRG_BANK_SLOT_COUNT]; // 每个bank槽当前映射的bank的预解码缓存
+        uint32_t _decodedVersion = 0;   // 与 Memory::prgVersion() 比较
+        uint32_t _decodedMapVersion = ~0u; // 与 Memory::prgMapVersion() 比较
+        
+        Jit _jit;
+        bool _jitDirty = false;         // 需要清空编译结果
+        
+        Jit::NativeBlock* _aotBlocks = 0; // 预编译的基本块 [$8000, $FFFF]
+        uint32_t _aotVersion = 0;       // 与 Memory::prgVersion() 比较
+        
+        int _blockCycles = 0;           // 当前块已执行的周期数
+        int _syncedCycles = 0;          // 当前块已同步给PPU的周期数
     };
     
     
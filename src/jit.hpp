@@ -0,0 +1,271 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string>
+#include <initializer_list>
+#include "type.hpp"
+
+namespace ReNes {
+    
+    // 编译单元中的一条指令
+    struct JitCmd {
+        uintptr_t handler;  // 指令处理函数 void(*)(CPU*, uint16_t)
+        uint16_t oper;      // 操作数
+        uint8_t cycles;     // 周期数
+        bool jump;          // JMP 绝对地址：直接写入PC，不调用 handler
+    };
+    
+    // x86-64 动态编译：把一个基本块编译成依次调用指令处理函数的本机代码（call-threading），
+    // 去掉了解释循环中的查表、分支预测失败和周期判断的开销。
+    // 生成的函数返回执行的指令条数，每条指令之后累加周期数，达到 budget 时提前返回，与 CPU::execBlock 的结束位置一致。
+    // 基本块跳回自己的起始地址时（等待循环、计数循环），直接在本机代码里继续循环，直到用完 budget
+    // 剩余的 budget 足够执行整个块时，使用不逐条检查周期的版本；JMP 绝对地址直接写入PC，不调用处理函数。
+    // 设置了环境变量 RENES_PERF_MAP 时，把编译的基本块写入 /tmp/perf-<pid>.map，perf 可以把采样对应到6502代码地址
+    class Jit {
+    
+    public:
+        
+        typedef int (*NativeBlock)(void* cpu, int* cycles, int budget);
+        
+        // 代码缓存大小
+        const static size_t CODE_SIZE = 4 * 1024 * 1024;
+        
+        // 每个基本块最多的指令条数
+        const static int BLOCK_CMD_MAX = 64;
+        
+        // 单条指令生成代码的最大长度
+        const static size_t CMD_CODE_SIZE_MAX = 40;
+        
+        // perf map 缓存的内容超过这个大小时写入文件
+        const static size_t PERF_MAP_FLUSH_SIZE = 64 * 1024;
+        
+        ~Jit()
+        {
+            _flushPerfMap();
+            
+            if (_code)
+                munmap(_code, CODE_SIZE);
+        }
+        
+        // 当前平台是否支持。代码缓存在第一次调用时才分配，不使用JIT的CPU不占用可执行内存
+        inline bool available()
+        {
+            if (!_allocated)
+                _allocate();
+            
+            return _code != 0;
+        }
+        
+        // 清空所有编译结果，之前返回的 NativeBlock 不能再使用
+        void reset()
+        {
+            _size = 0;
+            
+            _flushPerfMap();
+        }
+        
+        // 剩余空间是否能编译 count 条指令
+        inline bool hasSpace(int count) const
+        {
+            return _code && _size + (count * 2 + 4) * CMD_CODE_SIZE_MAX <= CODE_SIZE;
+        }
+        
+        // 编译一个基本块，pcOffset 是 PC 寄存器相对 cpu 指针的偏移，用于判断是否跳回了块的起始地址
+        NativeBlock compile(uint16_t pc, const JitCmd* cmds, int count, int32_t pcOffset)
+        {
+            if (count <= 0 || count > BLOCK_CMD_MAX || !hasSpace(count))
+                return 0;
+
+#if defined(__x86_64__)
+            uint8_t* begin = _code + _size;
+            _p = begin;
+            
+            // 需要跳转到函数结尾的位置（rel32）
+            uint8_t* exits[BLOCK_CMD_MAX + 1];
+            int exitCount = 0;
+            
+            // push rbx; push r12; push r13; push r14; sub rsp, 8 （之后栈按16字节对齐）
+            _emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xEC, 0x08});
+            // rbx = cpu; r12 = cycles; r13d = budget; r14d = 指令条数
+            _emit({0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x41, 0x89, 0xD5, 0x45, 0x31, 0xF6});
+            
+            int total = 0;
+            for (int i=0; i<count; i++)
+                total += cmds[i].cycles;
+            
+            uint8_t* loop = _p;
+            
+            // 整个块执行完也用不完 budget 时（*cycles + total < budget），走不需要逐条检查周期的路径
+            _emit({0x41, 0x8B, 0x04, 0x24});            // mov eax, dword [r12]
+            _emit({0x05}); _emit32(total);              // add eax, imm32
+            _emit({0x44, 0x39, 0xE8});                  // cmp eax, r13d
+            _emit({0x0F, 0x8D});                        // jge rel32
+            uint8_t* slow = _p;
+            _emit32(0);
+            
+            for (int i=0; i<count; i++)
+                _emitCall(cmds[i], pcOffset);
+            
+            _emit({0x41, 0x83, 0xC6, (uint8_t)count});  // add r14d, imm8
+            
+            // if (PC == pc) goto loop
+            _emit({0x66, 0x81, 0xBB}); _emit32(pcOffset); _emit16(pc); // cmp word [rbx+disp32], imm16
+            _emit({0x0F, 0x84}); _emit32((int32_t)(loop - (_p + 4)));  // je rel32
+            
+            _emit({0xE9});                              // jmp rel32
+            exits[exitCount++] = _p;
+            _emit32(0);
+            
+            // 逐条检查周期的路径，与 CPU::execBlock 在同一条指令之后结束
+            int32_t rel = (int32_t)(_p - (slow + 4));
+            memcpy(slow, &rel, 4);
+            
+            for (int i=0; i<count; i++)
+            {
+                _emitCall(cmds[i], pcOffset);
+                
+                _emit({0x41, 0xFF, 0xC6});          // inc r14d
+                
+                // if (*cycles >= budget) return
+                _emit({0x45, 0x39, 0x2C, 0x24});    // cmp dword [r12], r13d
+                _emit({0x0F, 0x8D});                // jge rel32
+                exits[exitCount++] = _p;
+                _emit32(0);
+            }
+            
+            // if (PC == pc) goto loop
+            _emit({0x66, 0x81, 0xBB}); _emit32(pcOffset); _emit16(pc); // cmp word [rbx+disp32], imm16
+            _emit({0x0F, 0x84}); _emit32((int32_t)(loop - (_p + 4)));  // je rel32
+            
+            // mov eax, r14d; add rsp, 8; pop r14; pop r13; pop r12; pop rbx; ret
+            uint8_t* epilogue = _p;
+            _emit({0x44, 0x89, 0xF0, 0x48, 0x83, 0xC4, 0x08, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+            
+            for (int i=0; i<exitCount; i++)
+            {
+                int32_t rel = (int32_t)(epilogue - (exits[i] + 4));
+                memcpy(exits[i], &rel, 4);
+            }
+            
+            _size = _p - _code;
+            
+            _writePerfMap(begin, _p - begin, pc);
+            
+            return (NativeBlock)begin;
+#else
+            return 0;
+#endif
+        }
+    
+    private:
+        
+        // handler(cpu, oper); *cycles += cycles
+        inline void _emitCall(const JitCmd& cmd, int32_t pcOffset)
+        {
+            if (cmd.jump)
+            {
+                _emit({0x66, 0xC7, 0x83}); _emit32(pcOffset); _emit16(cmd.oper); // mov word [rbx+disp32], imm16
+            }
+            else
+            {
+                _emit({0x48, 0x89, 0xDF});          // mov rdi, rbx
+                _emit({0xBE}); _emit32(cmd.oper);   // mov esi, imm32
+                _emit({0x48, 0xB8}); _emit64(cmd.handler); // mov rax, imm64
+                _emit({0xFF, 0xD0});                // call rax
+            }
+            
+            _emit({0x41, 0x83, 0x04, 0x24, cmd.cycles}); // add dword [r12], imm8
+        }
+        
+        inline void _emit(std::initializer_list<uint8_t> bytes)
+        {
+            for (uint8_t b : bytes)
+                *_p++ = b;
+        }
+        
+        inline void _emit16(uint16_t v)
+        {
+            memcpy(_p, &v, 2);
+            _p += 2;
+        }
+        
+        inline void _emit32(uint32_t v)
+        {
+            memcpy(_p, &v, 4);
+            _p += 4;
+        }
+        
+        inline void _emit64(uint64_t v)
+        {
+            memcpy(_p, &v, 8);
+            _p += 8;
+        }
+        
+        // 记录一条 perf map，先缓存在内存中，清空代码缓存、析构或者缓存的内容足够多时再写入文件
+        void _writePerfMap(const uint8_t* code, size_t size, uint16_t pc)
+        {
+            if (!_perfMap)
+                return;
+            
+            char line[64];
+            int length = snprintf(line, sizeof(line), "%lx %zx renes_6502_%04X\n", (unsigned long)(uintptr_t)code, size, pc);
+            _perfMapLines.append(line, length);
+            
+            if (_perfMapLines.size() >= PERF_MAP_FLUSH_SIZE)
+                _flushPerfMap();
+        }
+        
+        // 追加写入 /tmp/perf-<pid>.map，每次只写完整的行，同一进程中多个实例的记录不会交错
+        void _flushPerfMap()
+        {
+            if (_perfMapLines.empty())
+                return;
+            
+            char path[64];
+            snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+            
+            int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (fd >= 0)
+            {
+                if (write(fd, _perfMapLines.data(), _perfMapLines.size()) < 0)
+                {
+                    LOGE("无法写入 %s\n", path);
+                }
+                
+                close(fd);
+            }
+            
+            _perfMapLines.clear();
+        }
+        
+        void _allocate()
+        {
+            _allocated = true;
+            _perfMap = getenv("RENES_PERF_MAP") != 0;
+            
+#if defined(__x86_64__)
+            int flags = MAP_PRIVATE | MAP_ANON;
+#ifdef MAP_JIT
+            flags |= MAP_JIT;
+#endif
+            void* code = mmap(0, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, flags, -1, 0);
+            if (code != MAP_FAILED)
+                _code = (uint8_t*)code;
+#endif
+        }
+        
+        bool _allocated = false;
+        uint8_t* _code = 0; // 可执行的代码缓存
+        size_t _size = 0;   // 已使用的大小
+        uint8_t* _p = 0;    // 当前写入位置
+        
+        bool _perfMap = false;          // 是否输出 perf map（环境变量 RENES_PERF_MAP）
+        std::string _perfMapLines;      // 还没有写入文件的 perf map
+    };
+}
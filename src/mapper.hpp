@@ -0,0 +1,819 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "type.hpp"
+#include "mem.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+
+namespace ReNes {
+    
+    // 卡带：解析iNES文件头，保存PRG ROM、CHR ROM数据
+    struct Cartridge {
+        
+        const static int PRG_UNIT_SIZE = 0x4000;    // PRG ROM以16KB为单位
+        const static int CHR_UNIT_SIZE = 0x2000;    // CHR ROM以8KB为单位
+        const static int TRAINER_SIZE = 512;
+        
+        ~Cartridge()
+        {
+            // 映射文件时数据都指向映射区，只需要解除映射
+            if (_mapped)
+            {
+                munmap(_mapped, _mappedSize);
+                return;
+            }
+            
+            if (prg)
+                free((void*)prg);
+            
+            if (chr)
+                free((void*)chr);
+            
+            if (trainer)
+                free((void*)trainer);
+        }
+        
+        // 解析iNES文件，数据会被复制，返回是否成功
+        bool load(const uint8_t* rom, size_t length)
+        {
+            return _parse(rom, length, true);
+        }
+        
+        // 以只读方式映射ROM文件，PRG ROM、CHR ROM直接指向映射区，不复制。
+        // 同一个文件的映射共享系统的页缓存，多个实例只占用一份ROM内存，返回是否成功
+        bool map(const char* path)
+        {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+            {
+                LOGE("无法打开 %s\n", path);
+                return false;
+            }
+            
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size <= 0)
+            {
+                close(fd);
+                return false;
+            }
+            
+            void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            
+            // 映射建立后不再需要文件描述符
+            close(fd);
+            
+            if (data == MAP_FAILED)
+            {
+                LOGE("无法映射 %s\n", path);
+                return false;
+            }
+            
+            _mapped = data;
+            _mappedSize = st.st_size;
+            
+            return _parse((const uint8_t*)data, _mappedSize, false);
+        }
+        
+        // 映射区的起始地址，load 时为空
+        inline const uint8_t* mappedData() const
+        {
+            return (const uint8_t*)_mapped;
+        }
+        
+        inline size_t mappedSize() const
+        {
+            return _mappedSize;
+        }
+        
+        int mapperNumber = 0;
+        PPU::MIRRORING_MODE mirroring = PPU::MIRRORING_MODE_HORIZONTAL;
+        bool battery = false;
+        
+        const uint8_t* prg = 0;
+        size_t prgSize = 0;
+        
+        const uint8_t* chr = 0; // 为0时使用CHR RAM
+        size_t chrSize = 0;
+        
+        const uint8_t* trainer = 0; // 需要载入到 $7000-$71FF
+    
+    private:
+        
+        // copy 为false时数据指向 rom，rom 需要在卡带析构之前保持有效
+        bool _parse(const uint8_t* rom, size_t length, bool copy)
+        {
+            if (length < 16 || rom[0] != 'N' || rom[1] != 'E' || rom[2] != 'S' || rom[3] != 0x1A)
+            {
+                LOGE("不是iNES文件\n");
+                return false;
+            }
+            
+            bit8 flags6 = *(bit8*)&rom[6];
+            
+            // 高4位在Flags 7中，部分旧的dump工具在8-F写入了垃圾数据（例如"DiskDude!"），这时只使用低4位
+            bool nes2 = (rom[7] & 0x0C) == 0x08;
+            bool dirty = false;
+            for (int i=12; i<16; i++)
+                dirty |= rom[i] != 0;
+            
+            mapperNumber = rom[6] >> 4;
+            if (nes2 || !dirty)
+                mapperNumber |= rom[7] & 0xF0;
+            
+            mirroring = flags6.get(3) ? PPU::MIRRORING_MODE_FOUR_SCREEN : (PPU::MIRRORING_MODE)flags6.get(0);
+            battery = flags6.get(1);
+            
+            prgSize = rom[4] * PRG_UNIT_SIZE;
+            chrSize = rom[5] * CHR_UNIT_SIZE;   // 为0时，表明主板将使用板载CHR内存
+            
+            size_t offset = 16;
+            if (flags6.get(2))
+            {
+                if (length < offset + TRAINER_SIZE)
+                    return false;
+                
+                trainer = copy ? _copy(&rom[offset], TRAINER_SIZE) : &rom[offset];
+                offset += TRAINER_SIZE;
+            }
+            
+            if (prgSize == 0 || length < offset + prgSize + chrSize)
+            {
+                LOGE("ROM文件不完整\n");
+                return false;
+            }
+            
+            prg = copy ? _copy(&rom[offset], prgSize) : &rom[offset];
+            offset += prgSize;
+            
+            if (chrSize > 0)
+                chr = copy ? _copy(&rom[offset], chrSize) : &rom[offset];
+            
+            return true;
+        }
+        
+        static uint8_t* _copy(const uint8_t* data, size_t size)
+        {
+            uint8_t* buffer = (uint8_t*)malloc(size);
+            memcpy(buffer, data, size);
+            return buffer;
+        }
+        
+        void* _mapped = 0;      // map 时的文件映射区
+        size_t _mappedSize = 0;
+    };
+    
+    // 电池供电的PRG RAM：$6000-$7FFF 直接使用存档文件的共享映射（MAP_SHARED），写入只修改页缓存，
+    // 进程退出或者崩溃都不会丢失。后台线程每隔 SYNC_INTERVAL 对整个映射区调用 msync(MS_ASYNC) 请求写回，
+    // 由内核跟踪哪些页被修改过，模拟线程不会因为存档而阻塞；关闭时用 msync(MS_SYNC) 同步写回磁盘
+    class BatteryRam {
+    
+    public:
+        
+        const static int SIZE = Memory::PRG_RAM_SIZE;
+        const static int SYNC_INTERVAL = 1000;  // 后台写回的间隔（毫秒）
+        
+        ~BatteryRam()
+        {
+            close();
+        }
+        
+        // 打开（不存在时创建）存档文件，不足 SIZE 的部分补0，返回是否成功
+        bool open(const char* path)
+        {
+            close();
+            
+            int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+            if (fd < 0)
+            {
+                LOGE("无法打开存档 %s\n", path);
+                return false;
+            }
+            
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (st.st_size < SIZE && ftruncate(fd, SIZE) != 0))
+            {
+                ::close(fd);
+                return false;
+            }
+            
+            void* data = mmap(0, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            
+            if (data == MAP_FAILED)
+            {
+                LOGE("无法映射存档 %s\n", path);
+                return false;
+            }
+            
+            _data = (uint8_t*)data;
+            
+            _closing = false;
+            _syncThread = std::thread(&BatteryRam::_syncLoop, this);
+            
+            return true;
+        }
+        
+        // 停止后台线程，同步写回后解除映射
+        void close()
+        {
+            if (!_data)
+                return;
+            
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closing = true;
+            }
+            _cond.notify_one();
+            
+            if (_syncThread.joinable())
+                _syncThread.join();
+            
+            msync(_data, SIZE, MS_SYNC);
+            munmap(_data, SIZE);
+            _data = 0;
+        }
+        
+        inline uint8_t* data()
+        {
+            return _data;
+        }
+    
+    private:
+        
+        // 后台线程不读写映射区的内容（模拟线程随时在写），只定期请求内核写回，
+        // 内核自己记录哪些页被修改过，只写回这些页
+        void _syncLoop()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_closing)
+            {
+                _cond.wait_for(lock, std::chrono::milliseconds((int)SYNC_INTERVAL));
+                if (_closing)
+                    break;
+                
+                msync(_data, SIZE, MS_ASYNC);
+            }
+        }
+        
+        uint8_t* _data = 0;     // 存档文件的映射区
+        
+        std::thread _syncThread;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        bool _closing = false;
+    };
+    
+    // mapper：卡带上的bank切换电路。CPU写入 $8000-$FFFF 时调用 writeRegister，
+    // 切换bank只修改 Memory / VRAM 的页表指针，不复制数据
+    class Mapper {
+    
+    public:
+        
+        Mapper(const Cartridge* cart, CPU* cpu, Memory* mem, PPU* ppu)
+        :_cart(cart), _cpu(cpu), _mem(mem), _ppu(ppu)
+        {
+        }
+        
+        virtual ~Mapper()
+        {
+        }
+        
+        // 设置上电时的bank映射
+        virtual void reset() = 0;
+        
+        // CPU写入 $8000-$FFFF
+        virtual void writeRegister(uint16_t addr, uint8_t value)
+        {
+        }
+        
+        // 是否有可以写入的寄存器，没有时不需要处理CPU对 $8000-$FFFF 的写入
+        virtual bool hasRegisters() const
+        {
+            return true;
+        }
+    
+        // 设置给 Memory::setRomWriteHandler 的处理函数（target 为这个mapper）。
+        // 由 createMapper 按具体的mapper类型生成，直接调用该类型的 writeRegister，不经过虚函数表
+        inline
+        Memory::IOWriteHandler registerWriteHandler() const
+        {
+            return _registerWriteHandler;
+        }
+    
+    protected:
+        
+        // 映射8KB PRG ROM，bank 为负数时从最后一个bank开始计算
+        inline void _mapPrg8k(int slot, int bank)
+        {
+            _mem->mapPrgBank(slot, bank);
+        }
+        
+        // 映射16KB PRG ROM，slot 为0时映射到 $8000，为1时映射到 $C000
+        inline void _mapPrg16k(int slot, int bank)
+        {
+            _mem->mapPrgBank(slot * 2, bank * 2);
+            _mem->mapPrgBank(slot * 2 + 1, bank * 2 + 1);
+        }
+        
+        // 映射32KB PRG ROM到 $8000-$FFFF
+        inline void _mapPrg32k(int bank)
+        {
+            for (int i=0; i<4; i++)
+                _mem->mapPrgBank(i, bank * 4 + i);
+        }
+        
+        inline void _mapChr1k(int slot, int bank)
+        {
+            _ppu->mapChrPage(slot, bank);
+        }
+        
+        // 映射4KB图案表，slot 为0时映射到 $0000，为1时映射到 $1000
+        inline void _mapChr4k(int slot, int bank)
+        {
+            for (int i=0; i<4; i++)
+                _ppu->mapChrPage(slot * 4 + i, bank * 4 + i);
+        }
+        
+        inline void _mapChr8k(int bank)
+        {
+            for (int i=0; i<8; i++)
+                _ppu->mapChrPage(i, bank * 8 + i);
+        }
+        
+        // 卡带提供4屏VRAM时，忽略镜像设置
+        inline void _setMirroring(PPU::MIRRORING_MODE mode)
+        {
+            if (_cart->mirroring != PPU::MIRRORING_MODE_FOUR_SCREEN)
+                _ppu->initMirroring(mode);
+        }
+        
+        const Cartridge* _cart;
+        CPU* _cpu;
+        Memory* _mem;
+        PPU* _ppu;
+    
+    private:
+        
+        template <typename T>
+        static void _writeRegisterThunk(void* target, uint16_t addr, uint8_t value)
+        {
+            static_cast<T*>(static_cast<Mapper*>(target))->T::writeRegister(addr, value);
+        }
+        
+        template <typename T>
+        friend Mapper* _newMapper(const Cartridge* cart, CPU* cpu, Memory* mem, PPU* ppu);
+        
+        Memory::IOWriteHandler _registerWriteHandler = 0;
+    };
+    
+    // Mapper 0 (NROM): 16KB或32KB PRG ROM，8KB CHR，没有bank切换
+    class Mapper0 : public Mapper {
+    
+    public:
+        
+        using Mapper::Mapper;
+        
+        void reset() override
+        {
+            // 只有1个16KB的bank时，$C000 是 $8000 的镜像
+            _mapPrg16k(0, 0);
+            _mapPrg16k(1, -1);
+            _mapChr8k(0);
+        }
+        
+        bool hasRegisters() const override
+        {
+            return false;
+        }
+    };
+    
+    // Mapper 2 (UxROM): $8000 切换16KB PRG ROM，$C000 固定为最后一个bank，一般使用CHR RAM
+    class Mapper2 : public Mapper {
+    
+    public:
+        
+        using Mapper::Mapper;
+        
+        void reset() override
+        {
+            _mapPrg16k(0, 0);
+            _mapPrg16k(1, -1);
+            _mapChr8k(0);
+        }
+        
+        void writeRegister(uint16_t addr, uint8_t value) override
+        {
+            _mapPrg16k(0, value);
+        }
+    };
+    
+    // Mapper 3 (CNROM): 切换8KB CHR ROM
+    class Mapper3 : public Mapper {
+    
+    public:
+        
+        using Mapper::Mapper;
+        
+        void reset() override
+        {
+            _mapPrg16k(0, 0);
+            _mapPrg16k(1, -1);
+            _mapChr8k(0);
+        }
+        
+        void writeRegister(uint16_t addr, uint8_t value) override
+        {
+            _mapChr8k(value);
+        }
+    };
+    
+    // Mapper 7 (AxROM): 切换32KB PRG ROM，第4bit选择单屏镜像的名称表
+    class Mapper7 : public Mapper {
+    
+    public:
+        
+        using Mapper::Mapper;
+        
+        void reset() override
+        {
+            _mapPrg32k(0);
+            _mapChr8k(0);
+            _setMirroring(PPU::MIRRORING_MODE_ONE_SCREEN_LOWER);
+        }
+        
+        void writeRegister(uint16_t addr, uint8_t value) override
+        {
+            _mapPrg32k(value & 0x7);
+            _setMirroring((value & 0x10) ? PPU::MIRRORING_MODE_ONE_SCREEN_UPPER : PPU::MIRRORING_MODE_ONE_SCREEN_LOWER);
+        }
+    };
+    
+    // Mapper 1 (MMC1): 通过串行的5bit移位寄存器写入4个内部寄存器
+    // https://wiki.nesdev.com/w/index.php/MMC1
+    class Mapper1 : public Mapper {
+    
+    public:
+        
+        using Mapper::Mapper;
+        
+        void reset() override
+        {
+            _shift = 0;
+            _shiftCount = 0;
+            
+            // 上电时固定 $C000 为最后一个bank（PRG模式3），镜像使用文件头中的设置
+            _control = 0x0C | (_cart->mirroring == PPU::MIRRORING_MODE_VERTICAL ? 2 : 3);
+            _chr0 = 0;
+            _chr1 = 0;
+            _prg = 0;
+            
+            _update();
+        }
+        
+        void writeRegister(uint16_t addr, uint8_t value) override
+        {
+            // 连续周期的写入只有第一次有效，6502只有读-改-写指令会在连续的周期写入（同一条指令中写回原值、再写入新值）
+            if (_cpu->execCmdLine == _lastWriteCmdLine)
+                return;
+            _lastWriteCmdLine = _cpu->execCmdLine;
+            
+            // 第7bit为1时，重置移位寄存器，PRG模式设置为3
+            if (value & 0x80)
+            {
+                _shift = 0;
+                _shiftCount = 0;
+                _control |= 0x0C;
+                _update();
+                return;
+            }
+            
+            // 低位先写入，第5次写入时，按地址的13、14bit选择寄存器
+            _shift |= (value & 0x1) << _shiftCount;
+            if (++_shiftCount < 5)
+                return;
+            
+            switch ((addr >> 13) & 0x3)
+            {
+                case 0: _control = _shift; break;
+                case 1: _chr0 = _shift; break;
+                case 2: _chr1 = _shift; break;
+                case 3: _prg = _shift; break;
+            }
+            
+            _shift = 0;
+            _shiftCount = 0;
+            
+            _update();
+        }
+    
+    private:
+        
+        void _update()
+        {
+            // 镜像: 0 单屏(低) 1 单屏(高) 2 垂直 3 水平
+            const static PPU::MIRRORING_MODE MIRRORINGS[] = {
+                PPU::MIRRORING_MODE_ONE_SCREEN_LOWER,
+                PPU::MIRRORING_MODE_ONE_SCREEN_UPPER,
+                PPU::MIRRORING_MODE_VERTICAL,
+                PPU::MIRRORING_MODE_HORIZONTAL,
+            };
+            _setMirroring(MIRRORINGS[_control & 0x3]);
+            
+            // 512KB的PRG ROM（SUROM）用CHR寄存器的第4bit选择256KB的外部bank
+            int outer = _cart->prgSize > 0x40000 ? (_chr0 & 0x10) : 0;
+            int bank = (_prg & 0x0F) | outer;
+            int last = 0x0F | outer;
+            
+            switch ((_control >> 2) & 0x3)
+            {
+                case 0:
+                case 1:
+                    // 切换32KB，忽略最低位
+                    _mapPrg16k(0, bank & ~1);
+                    _mapPrg16k(1, bank | 1);
+                    break;
+                case 2:
+                    // $8000 固定为第一个bank
+                    _mapPrg16k(0, outer);
+                    _mapPrg16k(1, bank);
+                    break;
+                case 3:
+                    // $C000 固定为最后一个bank
+                    _mapPrg16k(0, bank);
+                    _mapPrg16k(1, last);
+                    break;
+            }
+            
+            if (_control & 0x10)
+            {
+                // 分别切换两个4KB
+                _mapChr4k(0, _chr0);
+                _mapChr4k(1, _chr1);
+            }
+            else
+            {
+                // 切换8KB，忽略最低位
+                _mapChr8k(_chr0 >> 1);
+            }
+        }
+        
+        uint8_t _shift = 0;
+        int _shiftCount = 0;
+        
+        uint8_t _control = 0;
+        uint8_t _chr0 = 0;
+        uint8_t _chr1 = 0;
+        uint8_t _prg = 0;
+        
+        long _lastWriteCmdLine = -1;    // 上一次写入时CPU执行的指令数
+    };
+    
+    // Mapper 4 (MMC3): 8KB PRG、1KB/2KB CHR bank切换，按PPU地址线A12的上升沿计数扫描线产生IRQ
+    // https://wiki.nesdev.com/w/index.php/MMC3
+    class Mapper4 : public Mapper, public A12Listener {
+    
+    public:
+        
+        using Mapper::Mapper;
+        
+        ~Mapper4()
+        {
+            _ppu->setA12Listener(0);
+            _cpu->setIRQLine(false);
+        }
+        
+        void reset() override
+        {
+            _bankSelect = 0;
+            for (int i=0; i<8; i++)
+                _regs[i] = 0;
+            
+            _irqLatch = 0;
+            _irqCounter = 0;
+            _irqReload = false;
+            _irqEnabled = false;
+            _cpu->setIRQLine(false);
+            
+            _ppu->setA12Listener(this);
+            
+            _update();
+        }
+        
+        void writeRegister(uint16_t addr, uint8_t value) override
+        {
+            // 按地址的13、14bit和第0bit选择寄存器
+            bool odd = addr & 0x1;
+            switch (addr & 0xE000)
+            {
+                case 0x8000:
+                    if (odd)
+                        _regs[_bankSelect & 0x7] = value;
+                    else
+                        _bankSelect = value;
+                    _update();
+                    break;
+                case 0xA000:
+                    // $A001 是PRG RAM保护，这里总是允许读写
+                    if (!odd)
+                        _setMirroring((value & 0x1) ? PPU::MIRRORING_MODE_HORIZONTAL : PPU::MIRRORING_MODE_VERTICAL);
+                    break;
+                case 0xC000:
+                    if (odd)
+                    {
+                        // 下一次上升沿时重新载入计数
+                        _irqCounter = 0;
+                        _irqReload = true;
+                    }
+                    else
+                        _irqLatch = value;
+                    break;
+                case 0xE000:
+                    // $E000 禁止IRQ并确认已经产生的IRQ，$E001 允许IRQ
+                    _irqEnabled = odd;
+                    if (!odd)
+                        _cpu->setIRQLine(false);
+                    break;
+            }
+        }
+        
+        void a12Rise() override
+        {
+            if (_irqCounter == 0 || _irqReload)
+            {
+                _irqCounter = _irqLatch;
+                _irqReload = false;
+            }
+            else
+                _irqCounter--;
+            
+            if (_irqCounter == 0 && _irqEnabled)
+                _cpu->setIRQLine(true);
+        }
+        
+        int a12RisesUntilIrq() const override
+        {
+            if (!_irqEnabled)
+                return 0;
+            
+            // 重新载入的那次上升沿不计数，锁存值为0时每次上升沿都会产生IRQ
+            if (_irqCounter == 0 || _irqReload)
+                return _irqLatch == 0 ? 1 : _irqLatch + 1;
+            
+            return _irqCounter;
+        }
+    
+    private:
+        
+        void _update()
+        {
+            // PRG模式0: R6 R7 -2 -1，模式1: -2 R7 R6 -1
+            bool prgSwapped = _bankSelect & 0x40;
+            _mapPrg8k(0, prgSwapped ? -2 : _regs[6]);
+            _mapPrg8k(1, _regs[7]);
+            _mapPrg8k(2, prgSwapped ? _regs[6] : -2);
+            _mapPrg8k(3, -1);
+            
+            // R0、R1 切换2KB（忽略最低位），R2-R5 切换1KB，CHR反转时交换 $0000 和 $1000
+            int chrSwapped = (_bankSelect & 0x80) ? 4 : 0;
+            _mapChr1k(0 ^ chrSwapped, _regs[0] & 0xFE);
+            _mapChr1k(1 ^ chrSwapped, _regs[0] | 0x01);
+            _mapChr1k(2 ^ chrSwapped, _regs[1] & 0xFE);
+            _mapChr1k(3 ^ chrSwapped, _regs[1] | 0x01);
+            for (int i=0; i<4; i++)
+                _mapChr1k((4 + i) ^ chrSwapped, _regs[2 + i]);
+        }
+        
+        uint8_t _bankSelect = 0;
+        uint8_t _regs[8];
+        
+        uint8_t _irqLatch = 0;
+        uint8_t _irqCounter = 0;
+        bool _irqReload = false;
+        bool _irqEnabled = false;
+    };
+    
+    // Mapper 9 (MMC2): $8000 切换8KB PRG ROM，其余固定为最后3个bank。
+    // 每个4KB图案表有两个bank寄存器，由PPU取到 $FD、$FE 的tile时锁存的值选择（见 PPU::setChrLatchBanks）
+    // https://wiki.nesdev.com/w/index.php/MMC2
+    class Mapper9 : public Mapper {
+    
+    public:
+        
+        using Mapper::Mapper;
+        
+        ~Mapper9()
+        {
+            _ppu->clearChrLatch();
+        }
+        
+        void reset() override
+        {
+            _mapPrg8k(0, 0);
+            _mapPrg8k(1, -3);
+            _mapPrg8k(2, -2);
+            _mapPrg8k(3, -1);
+            
+            _resetChr();
+        }
+        
+        void writeRegister(uint16_t addr, uint8_t value) override
+        {
+            if ((addr & 0xF000) == 0xA000)
+                _mapPrg8k(0, value & 0x0F);
+            else
+                _writeChrRegister(addr, value);
+        }
+    
+    protected:
+        
+        void _resetChr()
+        {
+            for (int i=0; i<4; i++)
+                _chr[i] = 0;
+            
+            _ppu->clearChrLatch();
+            _ppu->setChrLatchBanks(0, 0, 0);
+            _ppu->setChrLatchBanks(1, 0, 0);
+        }
+        
+        // $B000-$EFFF 图案表bank，$F000 镜像
+        void _writeChrRegister(uint16_t addr, uint8_t value)
+        {
+            int reg = ((addr >> 12) & 0xF) - 0xB;
+            if (reg >= 0 && reg < 4)
+            {
+                // $B000 $0000/$FD，$C000 $0000/$FE，$D000 $1000/$FD，$E000 $1000/$FE
+                _chr[reg] = value & 0x1F;
+                int table = reg / 2;
+                _ppu->setChrLatchBanks(table, _chr[table * 2], _chr[table * 2 + 1]);
+            }
+            else if ((addr & 0xF000) == 0xF000)
+            {
+                _setMirroring((value & 0x1) ? PPU::MIRRORING_MODE_HORIZONTAL : PPU::MIRRORING_MODE_VERTICAL);
+            }
+        }
+        
+        uint8_t _chr[4];
+    };
+    
+    // Mapper 10 (MMC4): 与MMC2相同，但是 $A000 切换16KB PRG ROM，$C000 固定为最后一个bank
+    // https://wiki.nesdev.com/w/index.php/MMC4
+    class Mapper10 : public Mapper9 {
+    
+    public:
+        
+        using Mapper9::Mapper9;
+        
+        void reset() override
+        {
+            _mapPrg16k(0, 0);
+            _mapPrg16k(1, -1);
+            
+            _resetChr();
+        }
+        
+        void writeRegister(uint16_t addr, uint8_t value) override
+        {
+            if ((addr & 0xF000) == 0xA000)
+                _mapPrg16k(0, value & 0x0F);
+            else
+                _writeChrRegister(addr, value);
+        }
+    };
+    
+    template <typename T>
+    inline Mapper* _newMapper(const Cartridge* cart, CPU* cpu, Memory* mem, PPU* ppu)
+    {
+        T* mapper = new T(cart, cpu, mem, ppu);
+        mapper->_registerWriteHandler = &Mapper::_writeRegisterThunk<T>;
+        return mapper;
+    }
+    
+    // 按mapper编号创建，不支持时返回0
+    inline Mapper* createMapper(int number, const Cartridge* cart, CPU* cpu, Memory* mem, PPU* ppu)
+    {
+        switch (number)
+        {
+            case 0: return _newMapper<Mapper0>(cart, cpu, mem, ppu);
+            case 1: return _newMapper<Mapper1>(cart, cpu, mem, ppu);
+            case 2: return _newMapper<Mapper2>(cart, cpu, mem, ppu);
+            case 3: return _newMapper<Mapper3>(cart, cpu, mem, ppu);
+            case 4: return _newMapper<Mapper4>(cart, cpu, mem, ppu);
+            case 7: return _newMapper<Mapper7>(cart, cpu, mem, ppu);
+            case 9: return _newMapper<Mapper9>(cart, cpu, mem, ppu);
+            case 10: return _newMapper<Mapper10>(cart, cpu, mem, ppu);
+            default: return 0;
+        }
+    }
+}
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <map>
 #include "type.hpp"
 #include <vector>
 
@@ -19,6 +18,8 @@ namespace ReNes {
             // 申请内存
             _data = (uint8_t*)malloc(DEFUALT_SIZE);
             memset(_data, 0, DEFUALT_SIZE);
+            
+            _initPages();
         }
         
         ~Memory()
@@ -39,18 +40,117 @@ namespace ReNes {
             return _data;
         }
         
-        void loadPRGRom(const uint8_t** romAddrs, int index)
+        // 按当前页表导出 $0000-$FFFF（包括切换的PRG bank、映射的PRG RAM），dst 至少 DEFUALT_SIZE 字节。
+        // I/O寄存器只取当前的值，不触发读取的副作用
+        void dump(uint8_t* dst) const
+        {
+            for (int i=0; i<DEFUALT_SIZE; i++)
+                dst[i] = get8bitData(i);
+        }
+        
+        // PRG RAM（$6000-$7FFF）
+        const static int PRG_RAM_OFFSET = 0x6000;
+        const static int PRG_RAM_SIZE = 0x2000;
+        
+        // 把 $6000-$7FFF 映射到外部的PRG RAM（例如电池存档文件的映射区），只修改页表，data 为空时恢复为内部内存
+        void setPrgRam(uint8_t* data)
+        {
+            if (!data)
+                data = _data + PRG_RAM_OFFSET;
+            
+            for (int i=0; i<(PRG_RAM_SIZE >> 8); i++)
+            {
+                _pages[(PRG_RAM_OFFSET >> 8) + i] = data + (i << 8);
+                _writePages[(PRG_RAM_OFFSET >> 8) + i] = data + (i << 8);
+            }
+        }
+        
+        // 当前映射到 $6000-$7FFF 的PRG RAM
+        inline
+        uint8_t* prgRam()
+        {
+            return _pages[PRG_RAM_OFFSET >> 8];
+        }
+        
+        // PRG ROM的bank大小，$8000-$FFFF 分为4个bank槽
+        const static int PRG_BANK_SIZE = 0x2000;
+        const static int PRG_BANK_SLOT_COUNT = 4;
+        
+        // 设置PRG ROM数据（只读，不复制），之后通过 mapPrgBank 映射到 $8000-$FFFF
+        void setPrgRom(const uint8_t* data, size_t size)
+        {
+            _prgRom = data;
+            _prgBankCount = (int)(size / PRG_BANK_SIZE);
+            
+            for (int i=0; i<PRG_BANK_SLOT_COUNT; i++)
+                mapPrgBank(i, i);
+            
+            // PRG ROM发生变化，预解码的指令全部失效
+            _prgVersion ++;
+        }
+        
+        // 将第 bank 个8KB的PRG ROM映射到第 slot 个bank槽（$8000 + slot*8KB），只修改页表，不复制数据
+        inline
+        void mapPrgBank(int slot, int bank)
         {
-            const int bankSize = 1024*16;
+            RENES_ASSERT(slot >= 0 && slot < PRG_BANK_SLOT_COUNT && _prgBankCount > 0);
             
-            int offset = bankSize*index;
-            memcpy(_data + PRG_ROM_LOWER_BANK_OFFSET + offset, romAddrs[index], bankSize);
+            bank %= _prgBankCount;
+            if (bank < 0)
+                bank += _prgBankCount;
+            
+            _prgBanks[slot] = bank;
+            
+            const int pagesPerBank = PRG_BANK_SIZE >> 8;
+            uint8_t* data = const_cast<uint8_t*>(_prgRom) + bank * PRG_BANK_SIZE;
+            for (int i=0; i<pagesPerBank; i++)
+                _pages[(PRG_ROM_LOWER_BANK_OFFSET >> 8) + slot * pagesPerBank + i] = data + (i << 8);
+            
+            _prgMapVersion ++;
+        }
+        
+        // addr 所在的bank槽当前映射的PRG ROM bank，addr 需要位于 $8000-$FFFF
+        inline
+        int prgBank(uint16_t addr) const
+        {
+            return _prgBanks[(addr >> 13) & (PRG_BANK_SLOT_COUNT - 1)];
+        }
+        
+        inline
+        int prgBankCount() const
+        {
+            return _prgBankCount;
+        }
+        
+        // 设置了mapper寄存器的写入处理函数时，$8000-$FFFF 的映射可能在运行时切换
+        inline
+        bool prgSwitchable() const
+        {
+            return _romWriteSlot.handler != 0;
+        }
+        
+        // PRG ROM版本，载入新的PRG ROM时变化，用于检查预解码缓存是否有效
+        inline
+        uint32_t prgVersion() const
+        {
+            return _prgVersion;
+        }
+        
+        // bank映射版本，每次 mapPrgBank 时变化
+        inline
+        uint32_t prgMapVersion() const
+        {
+            return _prgMapVersion;
         }
         
         // 直接获取8bit数据，不走读写监听
         inline
         uint8_t get8bitData(uint16_t addr) const
         {
+            const uint8_t* page = _pages[addr >> 8];
+            if (page)
+                return page[addr & 0xFF];
+            
             auto data = *const_cast<Memory*>(this)->_getRealAddr(addr);
             return data;
         }
@@ -59,13 +159,135 @@ namespace ReNes {
         inline
         uint16_t get16bitData(uint16_t addr) const
         {
+            // 跨页时两个字节可能来自不同的bank
+            const uint8_t* page = _pages[addr >> 8];
+            if (page && (addr & 0xFF) != 0xFF)
+                return *(const uint16_t*)(page + (addr & 0xFF));
+            
+            if (page)
+                return page[0xFF] | (get8bitData(addr + 1) << 8);
+            
             uint16_t data = *(uint16_t*)const_cast<Memory*>(this)->_getRealAddr(addr);
             return data;
         }
         
+        // 第 page 页（256字节）的数据，I/O页返回0
+        inline
+        const uint8_t* pageData(uint8_t page) const
+        {
+            return _pages[page];
+        }
+        
         // 读取数据
         inline
         uint8_t read8bitData(uint16_t addr, bool* valid=0)
+        {
+            // 没有I/O寄存器的页（RAM、ROM），直接读取
+            const uint8_t* page = _pages[addr >> 8];
+            if (page)
+            {
+                if (valid) *valid = true;
+                return page[addr & 0xFF];
+            }
+            
+            return _read8bitDataSlow(addr, valid);
+        }
+        
+        inline
+        void write8bitData(uint16_t addr, uint8_t value)
+        {
+            // 没有I/O寄存器的页（RAM），直接写入
+            uint8_t* page = _writePages[addr >> 8];
+            if (page)
+            {
+                page[addr & 0xFF] = value;
+                return;
+            }
+            
+            _write8bitDataSlow(addr, value);
+        }
+        
+        // I/O寄存器的读写处理函数，target 是处理寄存器的对象（PPU、控制器等）
+        typedef void (*IOWriteHandler)(void* target, uint16_t addr, uint8_t value);
+        typedef void (*IOReadHandler)(void* target, uint16_t addr, uint8_t* value, bool* valid);
+        typedef bool (*IODeferHandler)(const void* target, uint16_t addr);
+        
+        // 设置I/O寄存器 $2000-$2007（包括 $2008-$3FFF 的镜像）、$4000-$401F 的写入处理函数。
+        // 成员函数作为模板参数，在生成的转发函数中直接调用，不经过 std::function
+        template <typename T, void (T::*method)(uint16_t, uint8_t)>
+        void setIOWriteHandler(uint16_t addr, T* target)
+        {
+            IOWriteSlot& slot = _ioWriteSlots[_ioSlotIndex(addr)];
+            slot.handler = &_ioWriteThunk<T, method>;
+            slot.target = target;
+        }
+        
+        // 设置写入I/O寄存器之前是否可以不调用I/O访问监听者（不让PPU追上CPU），返回true时直接写入。
+        // 用于连续写入$2007（上传名称表、图案）的循环，省去每次写入时同步PPU
+        template <typename T, bool (T::*method)(uint16_t) const>
+        void setIOWriteDeferrable(uint16_t addr, T* target)
+        {
+            IOWriteSlot& slot = _ioWriteSlots[_ioSlotIndex(addr)];
+            slot.deferrable = &_ioDeferThunk<T, method>;
+            slot.target = target;
+        }
+        
+        // 设置I/O寄存器的读取处理函数，*value 是寄存器中的值，处理函数可以修改，*valid 设置为false表示读取无效
+        template <typename T, void (T::*method)(uint16_t, uint8_t*, bool*)>
+        void setIOReadHandler(uint16_t addr, T* target)
+        {
+            IOReadSlot& slot = _ioReadSlots[_ioSlotIndex(addr)];
+            slot.handler = &_ioReadThunk<T, method>;
+            slot.target = target;
+        }
+        
+        // 设置写入 $8000-$FFFF（卡带上的mapper寄存器）的处理函数，没有设置时忽略写入
+        template <typename T, void (T::*method)(uint16_t, uint8_t)>
+        void setRomWriteHandler(T* target)
+        {
+            setRomWriteHandler(&_ioWriteThunk<T, method>, target);
+        }
+        
+        void setRomWriteHandler(IOWriteHandler handler, void* target)
+        {
+            _romWriteSlot.handler = handler;
+            _romWriteSlot.target = target;
+        }
+        
+        void clearRomWriteHandler()
+        {
+            _romWriteSlot = IOWriteSlot();
+        }
+        
+        // 添加I/O访问监听者，访问 $2000-$401F 以及写入mapper寄存器之前调用（在读写处理函数之前），用于让PPU追上CPU
+        void setIOAccessObserver(std::function<void()> callback)
+        {
+            _ioAccessObserver = callback;
+        }
+        
+        bool error = false;
+    
+    private:
+        
+        // 每页256字节，页表中是该页在 _data 中的实际地址（已做镜像修正），$8000-$FFFF 指向PRG ROM中当前映射的bank。
+        // 不能按整页映射的页（I/O寄存器镜像 $2000-$3FFF、I/O寄存器所在的 $4000-$40FF）为空，走 _getRealAddr；
+        // PRG ROM只读，写入时交给mapper，在写入页表中为空
+        void _initPages()
+        {
+            for (int i=0; i<PAGE_COUNT; i++)
+            {
+                _pages[i] = _isIOPage(i) ? 0 : _getRealAddr(i << 8);
+                _writePages[i] = i < (PRG_ROM_LOWER_BANK_OFFSET >> 8) ? _pages[i] : 0;
+            }
+        }
+        
+        inline
+        bool _isIOPage(int page) const
+        {
+            return page >= 0x20 && page <= 0x40;
+        }
+        
+        uint8_t _read8bitDataSlow(uint16_t addr, bool* valid)
         {
             // 只在debug模式下检查内存错误，以提高release速度
 #ifdef DEBUG
@@ -87,13 +309,18 @@ namespace ReNes {
             }
 #endif
             
+            if (_isIOAddr(addr) && _ioAccessObserver)
+                _ioAccessObserver();
+            
             auto data = *_getRealAddr(addr);
             bool tmpValid = true;
 
-            // 检查地址监听
-            if (RENES_SET_FIND(addr8bitReadingObserver, addr))
+            // I/O寄存器处理
+            if (_isIOAddr(addr))
             {
-                addr8bitReadingObserver.at(addr)(addr, &data, &tmpValid);
+                const IOReadSlot& slot = _ioReadSlots[_ioSlotIndex(addr)];
+                if (slot.handler)
+                    slot.handler(slot.target, addr, &data, &tmpValid);
             }
             
             if (valid) *valid = tmpValid;
@@ -101,8 +328,7 @@ namespace ReNes {
             return data;
         }
         
-        inline
-        void write8bitData(uint16_t addr, uint8_t value)
+        void _write8bitDataSlow(uint16_t addr, uint8_t value)
         {
             // 只在debug模式下检查内存错误，以提高release速度
 #ifdef DEBUG
@@ -122,6 +348,30 @@ namespace ReNes {
             }
 #endif
             
+            // 写入mapper寄存器，可能切换图案表、镜像，需要先让PPU追上CPU
+            if (addr >= PRG_ROM_LOWER_BANK_OFFSET)
+            {
+                if (_romWriteSlot.handler)
+                {
+                    if (_ioAccessObserver)
+                        _ioAccessObserver();
+                    
+                    _romWriteSlot.handler(_romWriteSlot.target, addr, value);
+                }
+                return;
+            }
+            
+            if (!_isIOAddr(addr))
+            {
+                *_getRealAddr(addr) = value;
+                return;
+            }
+            
+            const IOWriteSlot& slot = _ioWriteSlots[_ioSlotIndex(addr)];
+            
+            if (_ioAccessObserver && !(slot.deferrable && slot.deferrable(slot.target, addr)))
+                _ioAccessObserver();
+            
             *_getRealAddr(addr) = value;
             
 //            for test
@@ -130,28 +380,42 @@ namespace ReNes {
 //                log("fuck\n");
 //            }
             
-            // 检查地址监听
-            if (RENES_SET_FIND(addrWritingObserver, addr))
-            {
-                addrWritingObserver.at(addr)(addr, value);
-            }
+            // I/O寄存器处理
+            if (slot.handler)
+                slot.handler(slot.target, addr, value);
         }
         
-        // 添加写入监听者
-        void addWritingObserver(uint16_t addr, std::function<void(uint16_t, uint8_t)> callback)
+        inline
+        bool _isIOAddr(uint16_t addr) const
         {
-            addrWritingObserver[addr] = callback;
+            return addr >= 0x2000 && addr < 0x4020;
         }
         
-        // 添加读取监听者
-        void addReadingObserver(uint16_t addr, std::function<void(uint16_t, uint8_t*, bool*)> callback)
+        // I/O寄存器的处理函数下标: $2000-$3FFF 按8字节镜像到 0-7，$4000-$401F 对应 8-39
+        inline
+        int _ioSlotIndex(uint16_t addr) const
         {
-            addr8bitReadingObserver[addr] = callback;
+            RENES_ASSERT(_isIOAddr(addr));
+            return addr < 0x4000 ? (addr & 0x7) : 8 + (addr - 0x4000);
         }
         
-        bool error = false;
-
-    private:
+        template <typename T, void (T::*method)(uint16_t, uint8_t)>
+        static void _ioWriteThunk(void* target, uint16_t addr, uint8_t value)
+        {
+            (static_cast<T*>(target)->*method)(addr, value);
+        }
+        
+        template <typename T, bool (T::*method)(uint16_t) const>
+        static bool _ioDeferThunk(const void* target, uint16_t addr)
+        {
+            return (static_cast<const T*>(target)->*method)(addr);
+        }
+        
+        template <typename T, void (T::*method)(uint16_t, uint8_t*, bool*)>
+        static void _ioReadThunk(void* target, uint16_t addr, uint8_t* value, bool* valid)
+        {
+            (static_cast<T*>(target)->*method)(addr, value, valid);
+        }
 
         // 得到实际内存地址
         inline
@@ -174,8 +438,35 @@ namespace ReNes {
         
         uint8_t* _data = 0;
         
+        const static int PAGE_COUNT = DEFUALT_SIZE >> 8;
+        
+        uint8_t* _pages[PAGE_COUNT];        // 可以直接读取的页，I/O页为空
+        uint8_t* _writePages[PAGE_COUNT];   // 可以直接写入的页，I/O页和PRG ROM为空
+        
+        const uint8_t* _prgRom = 0;
+        int _prgBankCount = 0;
+        int _prgBanks[PRG_BANK_SLOT_COUNT] = {0, 1, 2, 3}; // 每个bank槽映射的bank
+        
+        uint32_t _prgVersion = 0;
+        uint32_t _prgMapVersion = 0;
+        
+        const static int IO_SLOT_COUNT = 8 + 0x20;
+        
+        struct IOWriteSlot {
+            IOWriteHandler handler = 0;
+            void* target = 0;
+            IODeferHandler deferrable = 0;  // 为0时总是先调用I/O访问监听者
+        };
+        
+        struct IOReadSlot {
+            IOReadHandler handler = 0;
+            void* target = 0;
+        };
+        
+        IOWriteSlot _ioWriteSlots[IO_SLOT_COUNT];
+        IOReadSlot _ioReadSlots[IO_SLOT_COUNT];
+        IOWriteSlot _romWriteSlot;
         
-        std::map<uint16_t, std::function<void(uint16_t, uint8_t*, bool*)>> addr8bitReadingObserver;
-        std::map<uint16_t, std::function<void(uint16_t, uint8_t)>> addrWritingObserver;
+        std::function<void()> _ioAccessObserver;
     };
 }
@@ -2,6 +2,7 @@
 
 #include "mem.hpp"
 #include "vram.hpp"
+#include "compose.hpp"
 #include "mem.hpp"
 
 // 优化的显示模式
@@ -132,6 +133,21 @@ namespace ReNes {
         int height;
     };
 
+    // PPU地址线A12上升沿的监听者（MMC3等mapper用来按扫描线计数）
+    // 扫描线渲染没有逐点的取图案过程，PPU按图案表的选择算出每条扫描线上A12上升的点（见 PPU::_a12RiseDot）
+    struct A12Listener {
+        
+        virtual ~A12Listener()
+        {
+        }
+        
+        // A12上升沿
+        virtual void a12Rise() = 0;
+        
+        // 还需要多少次上升沿才会产生IRQ，不会产生IRQ时返回0
+        virtual int a12RisesUntilIrq() const = 0;
+    };
+    
     // 2C02
     class PPU {
         
@@ -139,11 +155,17 @@ namespace ReNes {
         
         enum MIRRORING_MODE{
             MIRRORING_MODE_HORIZONTAL = VRAM::MIRRORING_MODE_HORIZONTAL,
-            MIRRORING_MODE_VERTICAL = VRAM::MIRRORING_MODE_HORIZONTAL
+            MIRRORING_MODE_VERTICAL = VRAM::MIRRORING_MODE_VERTICAL,
+            MIRRORING_MODE_ONE_SCREEN_LOWER = VRAM::MIRRORING_MODE_ONE_SCREEN_LOWER,
+            MIRRORING_MODE_ONE_SCREEN_UPPER = VRAM::MIRRORING_MODE_ONE_SCREEN_UPPER,
+            MIRRORING_MODE_FOUR_SCREEN = VRAM::MIRRORING_MODE_FOUR_SCREEN,
         };
         
         std::string testLog;
         
+        // 扫描线像素合成使用的实现，默认是当前CPU支持的最快版本，各版本的结果完全一致
+        Compose::Kernel composeKernel = Compose::bestKernel();
+        
         const uint8_t* sprram() const
         {
             return _sprram;
@@ -154,9 +176,43 @@ namespace ReNes {
             return _vram;
         }
         
-        void loadPetternTable(const uint8_t* addr)
+        // 设置图案表数据（CHR ROM），data 为0时使用CHR RAM
+        void setChrData(const uint8_t* data, size_t size)
+        {
+            _vram->setChrData(data, size);
+            _bkRedrawAll = true;
+        }
+        
+        // 切换1KB的图案表页
+        // 背景和精灵在预渲染线上按当时的图案表绘制好，渲染期间切换时（如MMC3在IRQ中切换状态栏以下的图案）需要重新绘制
+        inline
+        void mapChrPage(int slot, int bank)
+        {
+            if (_vram->mapChrPage(slot, bank) && _isRendering())
+                _chrDirty = true;
+        }
+        
+        // MMC2/MMC4的锁存器：取到 $FD、$FE 的tile之后，切换这个tile所在的4KB图案表。
+        // table 为0时是 $0000，为1时是 $1000，fdBank、feBank 是锁存器为 $FD、$FE 时使用的4KB bank
+        void setChrLatchBanks(int table, int fdBank, int feBank)
+        {
+            _chrLatchEnabled = true;
+            _chrLatchBanks[table][0] = fdBank;
+            _chrLatchBanks[table][1] = feBank;
+            
+            if (_mapChrLatch(table) && _isRendering())
+                _chrDirty = true;
+        }
+        
+        // 取消锁存器，锁存器恢复为上电时的 $FE
+        void clearChrLatch()
         {
-            _vram->loadPetternTable(addr);
+            _chrLatchEnabled = false;
+            for (int i=0; i<2; i++)
+            {
+                _chrLatch[i] = 0xFE;
+                _chrLatchFrameStart[i] = 0xFE;
+            }
         }
         
         // 设置系统信息
@@ -177,9 +233,7 @@ namespace ReNes {
             // RGB 数据缓冲区
             _display_buffer = (uint8_t*)malloc(DISPLAY_BUFFER_LENGTH);
             
-            // 精灵缓冲区
-            _spr_buffer = (uint8_t*)malloc(SPR_BUFFER_LENGTH);
-            _spr0buffer = (uint8_t*)malloc(SPR_BUFFER_LENGTH);
+            // 精灵调试缓冲区
             _spr_bufferRGB = new RGB_Buffer(DISPLAY_BUFFER_PIXEL_WIDTH, DISPLAY_BUFFER_PIXEL_HEIGHT); // 像素单位是3字节，前3字节存储RGB
             
             // 卷轴缓冲区
@@ -196,10 +250,6 @@ namespace ReNes {
         {
             free(_display_buffer);
             
-            free(_spr_buffer);
-            
-            free(_spr0buffer);
-            
             free(_scrollBuffer);
             
             delete _spr_bufferRGB;
@@ -217,132 +267,6 @@ namespace ReNes {
             _mask_regs = (bit8*)&_io_regs[1];
             _status_regs = (bit8*)&_io_regs[2];
             
-            std::function<void(uint16_t, uint8_t)> writtingObserver = [this](uint16_t addr, uint8_t value){
-                switch (addr) {
-                    case 0x2000:
-                    {
-                        // t: ...BA.. ........ = d: ......BA
-                        _t &= ~(0x3 << 10);
-                        _t |= ((value & 0x3) << 10);
-                        break;
-                    }
-                    case 0x2003:
-                    {
-                        _dstAddr2004 = value;
-                        break;
-                    }
-                    case 0x2004:
-                    {
-                        // 问题1
-//                        if (_status_regs->get(7) == 1)
-                            _sprram[_dstAddr2004++ % 256] = value;
-                        break;
-                    }
-                    case 0x2005:
-                    {
-                        if (_w == 0)
-                        {
-                            // 低3位写入 _x
-                            // 高5位写入 _t 低5位
-                            _t &= ~0x1F;
-                            _t |= value >> 3;
-                            _x = value & 7; // 取低3位
-                        }
-                        else
-                        {
-                            // 低3位写入 _t 12~14位
-                            // 高5位写入 _t 位5~9
-                            _t &= ~0x73E0; // 清理 111 0011 1110 0000
-                            _t |= ((value & 0x7) << 12) | ((value >> 3) << 5);
-                        }
-
-                        _w = 1 - _w;
-                        break;
-                    }
-                    case 0x2006:
-                    {
-                        if (_w == 0)
-                        {
-                            // 低6位写入 _t 的8~13位 并将14位置零
-                            _t &= 0xFF;
-                            _t |= (value & 0x3F) << 8;
-                        }
-                        else
-                        {
-                            // 将8位全部写入 _t 的低8位
-                            _t &= ~0xFF;
-                            _t |= (value & 0xFF);
-                            _v = _t; // 第二次写入会覆盖 _v
-                            _2007ReadingStep = 0; // 每次_v生效，忽略从2007读取的第一个字节
-                        }
-                        _w = 1 - _w;
-                        break;
-                    }
-                    case 0x2007:
-                    {
-                        // 在每一次向$2007写数据后，地址会根据$2000的2bit位增加1或者32
-                        _vram->write8bitData(_v, value);
-                        
-                        // 通知
-//                        _vramDidUpdasted(_v);
-                        
-                        // 自动增加
-                        _v += _control_regs->get(2) == 0 ? 1 : 32;
-                        
-                        break;
-                    }
-                    case 0x4014:
-                    {
-                        memcpy(_sprram, &_mem->masterData()[value << 8], 256);
-                        break;
-                    }
-                    default:
-                        assert(!"error!");
-                        break;
-                }
-            };
-            
-            std::function<void(uint16_t, uint8_t*, bool*)> readingObserver = [this](uint16_t addr, uint8_t* value, bool* valid)
-            {
-                switch (addr) {
-                    case 0x2002: // 读取 0x2002会重置 _w 状态
-                        _w = 0;
-                        _status_regs->set(7, 0);
-                        break;
-                    case 0x2004:
-                        *value = _sprram[_dstAddr2004++ % 256];
-                        break;
-                    case 0x2007:
-                        // (从调色板之前的地址读取 [0, 3EFF] ) 第一次读取的值是无效的，会缓冲到下一次读取才返回
-                        if (_v <= 0x3EFF)
-                        {
-                            if (_2007ReadingStep == 0)
-                            {
-                                *valid = false;
-                            }
-                            else
-                            {
-                                *value = _2007ReadingCache;
-                            }
-                            
-                            _2007ReadingCache = _vram->read8bitData(_v);
-                        }
-                        else
-                        {
-                            _2007ReadingCache = _vram->read8bitData(_v);
-//                            printf("addr: %x %d\n", _v, _2007ReadingCache);
-                            *value = _2007ReadingCache;
-                        }
-                        
-                        _v += _control_regs->get(2) == 0 ? 1 : 32;
-                        _2007ReadingStep = 1;
-                        break;
-                    default:
-                        assert(!"error!");
-                        break;
-                }
-            };
-            
             /*
              
              Status ($2002) < read
@@ -370,29 +294,37 @@ namespace ReNes {
              
              */
             
-            mem->addWritingObserver(0x2000, writtingObserver);
-            mem->addReadingObserver(0x2002, readingObserver);
-            mem->addReadingObserver(0x2004, readingObserver);
-            mem->addReadingObserver(0x2007, readingObserver);
+            mem->setIOWriteHandler<PPU, &PPU::_write2000>(0x2000, this);
+            mem->setIOReadHandler<PPU, &PPU::_read2002>(0x2002, this);
+            mem->setIOReadHandler<PPU, &PPU::_read2004>(0x2004, this);
+            mem->setIOReadHandler<PPU, &PPU::_read2007>(0x2007, this);
             
-            // 精灵读写监听
-            mem->addWritingObserver(0x2003, writtingObserver);
-            mem->addWritingObserver(0x2004, writtingObserver);
-            mem->addWritingObserver(0x2005, writtingObserver);
+            // 精灵读写
+            mem->setIOWriteHandler<PPU, &PPU::_write2003>(0x2003, this);
+            mem->setIOWriteHandler<PPU, &PPU::_write2004>(0x2004, this);
+            mem->setIOWriteHandler<PPU, &PPU::_write2005>(0x2005, this);
             
-            // vram读写监听
-            mem->addWritingObserver(0x2006, writtingObserver);
-            mem->addWritingObserver(0x2007, writtingObserver);
+            // vram读写
+            mem->setIOWriteHandler<PPU, &PPU::_write2006>(0x2006, this);
+            mem->setIOWriteHandler<PPU, &PPU::_write2007>(0x2007, this);
+            mem->setIOWriteDeferrable<PPU, &PPU::_vramWriteDeferrable>(0x2007, this);
             
-            // DMA拷贝监听
-            mem->addWritingObserver(0x4014, writtingObserver);
+            // DMA拷贝
+            mem->setIOWriteHandler<PPU, &PPU::_write4014>(0x4014, this);
         }
         
+        // 可以在运行时由mapper重新设置
         void initMirroring(MIRRORING_MODE mode)
         {
             _vram->initMirroring((VRAM::MIRRORING_MODE)mode);
         }
         
+        // 设置A12上升沿的监听者，为0时取消
+        void setA12Listener(A12Listener* listener)
+        {
+            _a12Listener = listener;
+        }
+        
         // 预渲染
         void doPreRenderLine()
         {
@@ -434,7 +366,6 @@ namespace ReNes {
             
             // 绘制背景
 //            const uint8_t* sprPetternTableAddr = _sprPetternTableAddress();
-            const uint8_t* sprPaletteAddr = _sprPaletteAddress();  // 精灵调色板地址
             
             //            const static RGB* pTRANSPARENT_RGB = (RGB*)&DEFAULT_PALETTE[bkPaletteAddr[0]*3];
             
@@ -499,80 +430,337 @@ namespace ReNes {
              
              */
 
-            // 绘制精灵到缓冲区，用来给扫描线使用
-            memset(_spr_buffer, 0, SPR_BUFFER_LENGTH);
-            memset(_spr0buffer, 0, SPR_BUFFER_LENGTH);
+            // 锁存器按取tile的顺序变化，本帧从上一帧结束时的状态开始
+            _chrLatchFrameStart[0] = _chrLatch[0];
+            _chrLatchFrameStart[1] = _chrLatch[1];
+            
+            // 准备精灵每一行的像素，用来给扫描线使用
+            _prepareSprites();
+            
+            // 设置帧空白
+            memset(_display_buffer, 0, DISPLAY_BUFFER_LENGTH);
+            
+            // 绘制全部名称表到_scrollBuffer，可用于 to RGB buffer，以及优化的显示模式下的像素叠加
+            _renderNameTables();
+            
+            _chrDirty = false;
+            _bkRowsStale = false;
+        }
+        
+        // 准备当前帧OAM中每个精灵逐行的像素数据，扫描线开始时按行取用（见 _evaluateSprites、_drawSpriteLine）
+        // 按OAM的顺序取tile，与锁存器的变化顺序一致
+        void _prepareSprites()
+        {
+            _sprHeight = _control_regs->get(5) ? 16 : 8;
+            
+            if (_chrLatchEnabled)
+            {
+                _setChrLatch(0, _chrLatchFrameStart[0]);
+                _setChrLatch(1, _chrLatchFrameStart[1]);
+            }
             
-            // 精灵0必须在最上面以供碰撞检测
             for (int i=0; i<64; i++)
             {
                 Sprite* spr = (Sprite*)&_OAM[i*4];
                 if (*(int*)spr == 0) // 没有精灵数据
                     continue;
                 
-//                const uint8_t* tileAddr = &sprPetternTableAddr[spr->tileIndex * 16];
-                const uint8_t* tileAddr = _sprPetternTableAddress(spr->tileIndex);
+                // 只有可见扫描线上的行会用到
+                if (spr->y+1 < RENES_FRAME_VISIBLE_H)
+                {
+                    int high2 = spr->info.get(0) | (spr->info.get(1) << 1);
+                    bool sprFront = spr->info.get(5); // 优先级，0 - 在背景上 1 - 在背景下
+                    bool flipH = spr->info.get(6); // 水平翻转
+                    bool flipV = spr->info.get(7); // 竖直翻转
+                    
+                    // 解码后的tile，已经按水平翻转排列，8x16的精灵有上下两个tile
+                    const uint8_t* topTile = _sprTile(spr->tileIndex, 0, flipH);
+                    const uint8_t* bottomTile = _sprHeight == 16 ? _sprTile(spr->tileIndex, 1, flipH) : 0;
+
+                    // 11 11 1111
+                    // 6、7bit: 未使用
+                    // 5 bit: 第一精灵标记
+                    // 4 bit: 前置精灵标记
+                    // 低4bit: [16]调色板下标
+                    int sprData = (i == 0 ? (3 << 5) : 0) | (sprFront << 4) | (high2 << 2);
+                
+                    for (int ty=0; ty<_sprHeight; ty++)
+                    {
+                        int ty_ = flipV ? _sprHeight-1-ty : ty; // 竖直翻转时8x16的两个tile也上下交换
+                        const uint8_t* src = &(ty_ >= 8 ? bottomTile : topTile)[(ty_%8) * 8];
                 
-                int high2 = spr->info.get(0) | (spr->info.get(1) << 1);
-                bool sprFront = spr->info.get(5); // 优先级，0 - 在背景上 1 - 在背景下
-                bool flipH = spr->info.get(6); // 水平翻转
-                bool flipV = spr->info.get(7); // 竖直翻转
+                        uint8_t* row = &_sprRows[i][ty * 8];
+                        uint8_t mask = 0;
+                        for (int tx=0; tx<8; tx++)
+                        {
+                            // 引用到透明色（调色板单元第一位）的像素不绘制
+                            row[tx] = src[tx] != 0 ? sprData | src[tx] : 0;
+                            mask |= (src[tx] != 0) << tx;
+                        }
+                        _sprRowMasks[i][ty] = mask;
+                    }
+                }
                 
-//                printf("[%d] %d,%d\n", i, spr->x, spr->y);
+                // 按OAM的顺序取tile，8x16的精灵先取上半部分
+                if (_chrLatchEnabled)
+                {
+                    if (_control_regs->get(5))
+                    {
+                        _fetchChrLatch(spr->tileIndex & 0x1, spr->tileIndex & 0xFE);
+                        _fetchChrLatch(spr->tileIndex & 0x1, spr->tileIndex | 0x01);
+                    }
+                    else
+                        _fetchChrLatch(_control_regs->get(3), spr->tileIndex);
+                }
+            }
+        }
+        
+        // 精灵求值：按OAM的顺序找出扫描线 line 上的精灵，前8个的编号写入 secondary（可以为0），
+        // 返回找到的数量，超过8个时返回9（精灵溢出）
+        int _evaluateSprites(int line, uint8_t* secondary) const
+        {
+            int count = 0;
+            for (int i=0; i<64; i++)
+            {
+                const Sprite* spr = (const Sprite*)&_OAM[i*4];
+                if (*(int*)spr == 0) // 没有精灵数据
+                    continue;
                 
-                drawSprBuffer(_spr_buffer, spr->x, spr->y+1, high2, tileAddr, sprPaletteAddr, flipH, flipV, i == 0, sprFront);
+                // 精灵在Y坐标的下一条扫描线开始显示
+                unsigned row = line - (spr->y+1);
+                if (row >= (unsigned)_sprHeight)
+                    continue;
+                
+                if (count == 8)
+                    return 9;
                 
-                // 精灵0再额外存储到一个buffer，用于检测
-                if (i == 0)
-                    drawSprBuffer(_spr0buffer, spr->x, spr->y+1, high2, tileAddr, sprPaletteAddr, flipH, flipV, i == 0, sprFront);
+                if (secondary)
+                    secondary[count] = i;
+                count++;
             }
+            return count;
+        }
+        
+        // 把 secondary 中的 count 个精灵在扫描线 line 上的像素绘制到 buffer（RENES_FRAME_VISIBLE_W + 8 字节），
+        // 编号小的精灵在上面。返回精灵覆盖的范围 [begin, end)，没有精灵时 begin >= end
+        void _drawSpriteLine(uint8_t* buffer, int line, const uint8_t* secondary, int count, int* begin, int* end) const
+        {
+            memset(buffer, 0, RENES_FRAME_VISIBLE_W + 8);
             
-            // 绘制全部名称表到_scrollBuffer，可用于 to RGB buffer，以及优化的显示模式下的像素叠加
+            *begin = RENES_FRAME_VISIBLE_W;
+            *end = 0;
+            
+            for (int k=0; k<count; k++)
+            {
+                int i = secondary[k];
+                const Sprite* spr = (const Sprite*)&_OAM[i*4];
+                
+                int ty = line - (spr->y+1);
+                if (_sprRowMasks[i][ty] == 0)
+                    continue;
+                
+                // 超出屏幕右边的像素写入缓冲区末尾的8字节，不会显示
+                const uint8_t* row = &_sprRows[i][ty * 8];
+                uint8_t* dst = &buffer[spr->x];
+                for (int tx=0; tx<8; tx++)
+                {
+                    if (dst[tx] == 0)
+                        dst[tx] = row[tx];
+                }
+                
+                *begin = NES_MIN(*begin, (int)spr->x);
+                *end = NES_MAX(*end, NES_MIN(spr->x + 8, RENES_FRAME_VISIBLE_W));
+            }
+        }
+        
+        // 扫描线开始时的精灵求值，8个以上精灵时设置精灵溢出标记
+        void _evaluateScanline(int line)
+        {
+            _secondaryCount = _evaluateSprites(line, _secondaryOAM);
+            if (_secondaryCount > 8)
+            {
+                _status_regs->set(5, 1);
+                _secondaryCount = 8;
+            }
+            
+            _drawSpriteLine(_sprLine, line, _secondaryOAM, _secondaryCount, &_sprLineBegin, &_sprLineEnd);
+        }
+            
+        // 绘制名称表到 _scrollBuffer
+        // 上次绘制之后背景图案表、名称表的映射都没有变化时，只重新绘制写入过的tile（见 VRAM::nameTableDirtyTiles），
+        // 以及上一帧渲染期间按切换后的图案重新绘制过的行
+        void _renderNameTables()
+        {
+            int bkTable = _control_regs->get(4);
+            
+            // 背景使用的4页图案表和4个名称表
+            const uint8_t* patternPages[4];
+            const uint8_t* nameTablePages[4];
+            for (int i=0; i<4; i++)
+            {
+                patternPages[i] = _vram->page(bkTable * 4 + i);
+                nameTablePages[i] = _vram->page(VRAM::NAME_TABLE_PAGE + i);
+            }
+            
+            // MMC2/MMC4的锁存器在绘制过程中切换图案表，每次都全部重新绘制
+            if (_bkRedrawAll || _chrLatchEnabled || bkTable != _renderedBkTable || memcmp(nameTablePages, _renderedNameTablePages, sizeof(nameTablePages)) != 0)
+            {
+                _renderAllNameTables();
+                
+                _bkRedrawAll = _chrLatchEnabled;
+                _renderedBkTable = bkTable;
+                memcpy(_renderedNameTablePages, nameTablePages, sizeof(nameTablePages));
+                
+                for (int tile_y=0; tile_y<30; tile_y++)
+                    memcpy(_renderedRowPages[tile_y], patternPages, sizeof(patternPages));
+            }
+            else
             {
-                // 设置帧空白
-                memset(_display_buffer, 0, DISPLAY_BUFFER_LENGTH);
+                for (int tile_y=0; tile_y<30; tile_y++)
+                    _renderNameTableRow(tile_y);
                 
-                // 绘制每个名称表 -> scrollBuffer
-//                for (int i=0; i<4; i++)
-//                {
-//                    updateBackgroundTile(i, 0, 0, 32, 30);
-//                }
+                _renderDirtyNameTables(bkTable);
+            }
+            
+            _vram->clearBackgroundDirty();
+        }
+        
+        // 每个名称表的位置绘制哪个名称表：与 _renderAllNameTables 相同，绘制自身，或者复制先绘制的镜像
+        void _nameTableSources(int sources[4])
+        {
+            bool updatedNameTableIndex[4] = {false};
+            for (int i=0; i<4; i++)
+            {
+                if (updatedNameTableIndex[i])
+                    continue;
                 
-                // 绘制部分名称表，拷贝其镜像 -> scrollBuffer
-                bool updatedNameTableIndex[4] = {false};
+                sources[i] = i;
+                updatedNameTableIndex[i] = true;
                 
-                for (int i=0; i<4; i++)
+                int mirroringIndex = _vram->nameTableMirroring(i);
+                sources[mirroringIndex] = i;
+                updatedNameTableIndex[mirroringIndex] = true;
+            }
+        }
+        
+        // 第 tile_y 行tile绘制时的背景图案表和当前不同时，按当前的图案表重新绘制这一行（4个名称表的位置）
+        // 渲染期间切换图案表（如MMC3在IRQ中切换状态栏的图案）后，扫描线只重新绘制之后用到的行
+        void _renderNameTableRow(int tile_y)
+        {
+            int bkTable = _control_regs->get(4);
+            
+            const uint8_t* patternPages[4];
+            for (int i=0; i<4; i++)
+                patternPages[i] = _vram->page(bkTable * 4 + i);
+            
+            if (memcmp(patternPages, _renderedRowPages[tile_y], sizeof(patternPages)) == 0)
+                return;
+            
+            int sources[4];
+            _nameTableSources(sources);
+            
+            for (int i=0; i<4; i++)
+                _updateBackgroundTile(i, sources[i], 0, tile_y, 32, 1);
+            
+            memcpy(_renderedRowPages[tile_y], patternPages, sizeof(patternPages));
+        }
+        
+        // 只重新绘制写入过的tile，以及使用了写入过的图案的tile
+        void _renderDirtyNameTables(int bkTable)
+        {
+            int sources[4];
+            _nameTableSources(sources);
+            
+            bool patternDirty = _vram->patternDirty(bkTable);
+            
+            for (int i=0; i<4; i++)
+            {
+                // drawBackground 按 (tableIndex + s_x/32) % 2 读取名称表
+                int nameTableIndex = sources[i] % 2;
+                if (!patternDirty && !_vram->nameTableDirty(nameTableIndex))
+                    continue;
+                
+                const uint8_t* nameTableAddr = _nameTableAddress(nameTableIndex);
+                const bool* dirty = _vram->nameTableDirtyTiles(nameTableIndex);
+                
+                for (int tile_y=0; tile_y<30; tile_y++)
                 {
-                    if (updatedNameTableIndex[i])
-                        continue;
-                    
-                    // 遍历里面32x30字节，更新其中 == index 的项目（这里等于全部刷新）
-                    updateBackgroundTile(i, 0, 0, 32, 30);
-                    updatedNameTableIndex[i] = true;
-                    
-                    // 检查其镜像，有，则进行数据拷贝
-                    int mirroringIndex = _vram->nameTableMirroring(i);
-                    if (mirroringIndex != i)
+                    // 一行中连续的tile一起绘制
+                    int first = -1;
+                    for (int tile_x=0; tile_x<=32; tile_x++)
                     {
-                        updatedNameTableIndex[mirroringIndex] = true;
-                        // 复制src -> 镜像
-                        const static int scrollBufferOffset[] = {
-                            0, DISPLAY_BUFFER_PIXEL_WIDTH,
-                            DISPLAY_BUFFER_PIXEL_CONUT*2, DISPLAY_BUFFER_PIXEL_CONUT*2+DISPLAY_BUFFER_PIXEL_WIDTH
-                        };
+                        int ti = tile_y*32 + tile_x;
+                        bool redraw = tile_x < 32 && (dirty[ti] || (patternDirty && _vram->patternTileDirty(bkTable, nameTableAddr[ti])));
                         
-                        const uint8_t* srcAddr = _scrollBuffer + scrollBufferOffset[i];
-                        const uint8_t* mirrAddr = _scrollBuffer + scrollBufferOffset[mirroringIndex];
-                        int stride = 256*2;
-                        for (int y=0; y<240; y++)
+                        if (redraw && first < 0)
+                        {
+                            first = tile_x;
+                        }
+                        else if (!redraw && first >= 0)
                         {
-                            memcpy((void*)(mirrAddr+y*stride), (void*)(srcAddr+y*stride), 256);
+                            _updateBackgroundTile(i, sources[i], first, tile_y, tile_x - first, 1);
+                            first = -1;
                         }
                     }
                 }
             }
         }
         
+        // 绘制全部名称表到 _scrollBuffer
+        void _renderAllNameTables()
+        {
+            // 绘制每个名称表 -> scrollBuffer
+//            for (int i=0; i<4; i++)
+//            {
+//                updateBackgroundTile(i, 0, 0, 32, 30);
+//            }
+            
+            // 绘制部分名称表，拷贝其镜像 -> scrollBuffer
+            bool updatedNameTableIndex[4] = {false};
+            
+            // 每个名称表都从本帧开始时的锁存器状态按行绘制，结束时的状态使用显示的名称表的
+            int bkTable = _control_regs->get(4);
+            uint8_t latchEnd[4];
+            
+            for (int i=0; i<4; i++)
+            {
+                if (updatedNameTableIndex[i])
+                    continue;
+                
+                if (_chrLatchEnabled)
+                    _setChrLatch(bkTable, _chrLatchFrameStart[bkTable]);
+                
+                // 遍历里面32x30字节，更新其中 == index 的项目（这里等于全部刷新）
+                updateBackgroundTile(i, 0, 0, 32, 30);
+                updatedNameTableIndex[i] = true;
+                latchEnd[i] = _chrLatch[bkTable];
+                
+                // 检查其镜像，有，则进行数据拷贝
+                int mirroringIndex = _vram->nameTableMirroring(i);
+                if (mirroringIndex != i)
+                {
+                    updatedNameTableIndex[mirroringIndex] = true;
+                    latchEnd[mirroringIndex] = latchEnd[i];
+                    // 复制src -> 镜像
+                    const static int scrollBufferOffset[] = {
+                        0, DISPLAY_BUFFER_PIXEL_WIDTH,
+                        DISPLAY_BUFFER_PIXEL_CONUT*2, DISPLAY_BUFFER_PIXEL_CONUT*2+DISPLAY_BUFFER_PIXEL_WIDTH
+                    };
+                    
+                    const uint8_t* srcAddr = _scrollBuffer + scrollBufferOffset[i];
+                    const uint8_t* mirrAddr = _scrollBuffer + scrollBufferOffset[mirroringIndex];
+                    int stride = 256*2;
+                    for (int y=0; y<240; y++)
+                    {
+                        memcpy((void*)(mirrAddr+y*stride), (void*)(srcAddr+y*stride), 256);
+                    }
+                }
+            }
+            
+            if (_chrLatchEnabled)
+                _setChrLatch(bkTable, latchEnd[_control_regs->get(0) | (_control_regs->get(1) << 1)]);
+        }
+        
         // 在当前扫描线执行 pixelCount 次像素渲染
         void drawScanline(bool* vblankEvent, int pixelCount)
         {
@@ -581,6 +769,81 @@ namespace ReNes {
             _drawScanline(vblankEvent, pixelCount);
         }
         
+        // 距离下一个事件（vblank开始、预渲染线开始、当前帧结束、mapper产生IRQ）还需要绘制的扫描点数
+        inline
+        int pixelsUntilNextEvent() const
+        {
+            // 事件在第239条扫描线、预渲染线之前的一条扫描线（预渲染线开始时绘制名称表和精灵）和最后一条扫描线绘制完成时发生
+            int lastLine = _scanline_y <= RENES_FRAME_VISIBLE_H-1 ? RENES_FRAME_VISIBLE_H-1 : (_scanline_y < _frame_h-1 ? _frame_h-2 : _frame_h-1);
+            
+            // 扫描线完成时多出的点会多加1个点带入下一条扫描线（见 _drawScanline），所以之后的每条扫描线只需要 _frame_w-1 个点
+            int pixels = (_frame_w - _scanline_x) + (lastLine - _scanline_y) * (_frame_w - 1);
+            
+            if (_a12Listener)
+                pixels = NES_MIN(pixels, _pixelsUntilA12Irq(pixels));
+            
+            return pixels;
+        }
+        
+        // 距离$2002的值可能发生变化还需要绘制的扫描点数（保守估计），用于跳过轮询$2002的循环
+        int pixelsUntilStatusChange()
+        {
+            // 上一次读取清除了vblank标记，下一次读取的值已经不同
+            if (_2002ReadClearedVblank)
+                return 0;
+            
+            // vblank开始、帧结束
+            int pixels = pixelsUntilNextEvent();
+            
+            // 预渲染线开始时清除标记
+            if (_scanline_y >= RENES_FRAME_VISIBLE_H && _scanline_y < _frame_h-1)
+                pixels = NES_MIN(pixels, _pixelsUntil(_frame_h-1, 0));
+            
+            // 精灵溢出在可见扫描线开始时求值时设置
+            if (_status_regs->get(5) == 0)
+            {
+                int line = _scanline_x == 0 ? _scanline_y : _scanline_y+1;
+                for (; line<RENES_FRAME_VISIBLE_H; line++)
+                {
+                    int p = _pixelsUntil(line, 0);
+                    if (p >= pixels)
+                        break;
+                    
+                    if (_evaluateSprites(line, 0) > 8)
+                    {
+                        pixels = p;
+                        break;
+                    }
+                }
+            }
+            
+            // 精灵0碰撞，只可能发生在0号精灵的像素上
+            const Sprite* spr0 = (const Sprite*)_OAM;
+            if (_status_regs->get(6) == 0 && *(int*)spr0 != 0)
+            {
+                int lineEnd = NES_MIN(spr0->y+1 + _sprHeight, RENES_FRAME_VISIBLE_H);
+                for (int line=NES_MAX(_scanline_y, spr0->y+1); line<lineEnd; line++)
+                {
+                    int x = line == _scanline_y ? _scanline_x : 0;
+                    if (_pixelsUntil(line, x) >= pixels)
+                        break;
+                    
+                    // 这一行在 x 之后、屏幕以内的不透明像素
+                    int mask = _sprRowMasks[0][line - (spr0->y+1)];
+                    int skip = NES_MAX(x - spr0->x, 0);
+                    mask &= skip < 8 ? 0xFF << skip : 0;
+                    mask &= RENES_FRAME_VISIBLE_W - spr0->x < 8 ? (1 << (RENES_FRAME_VISIBLE_W - spr0->x)) - 1 : 0xFF;
+                    if (mask != 0)
+                    {
+                        pixels = NES_MIN(pixels, _pixelsUntil(line, spr0->x + __builtin_ctz(mask)));
+                        break;
+                    }
+                }
+            }
+            
+            return pixels;
+        }
+        
         inline
         bool currentFrameOver() const
         {
@@ -602,17 +865,27 @@ namespace ReNes {
             }
         }
         
+        // 精灵按当前帧的OAM逐条扫描线求值后绘制
         void dumpSpriteToBufferRGB()
         {
             const uint8_t* sprPaletteAddr = _sprPaletteAddress();
             
+            uint8_t secondary[8];
+            uint8_t line[RENES_FRAME_VISIBLE_W + 8];
+            int begin, end;
+            
             // convert to RGB buffer
-            int size = DISPLAY_BUFFER_PIXEL_WIDTH*DISPLAY_BUFFER_PIXEL_HEIGHT;
-            for (int i=0; i<size; i++)
+            for (int y=0; y<DISPLAY_BUFFER_PIXEL_HEIGHT; y++)
             {
-                int systemPaletteUnitIndex = sprPaletteAddr[_spr_buffer[i]]; // 系统默认调色板颜色索引 [0,63]
-                RGB* rgb = (RGB*)&DEFAULT_PALETTE[systemPaletteUnitIndex*3];
-                ((RGB*)_spr_bufferRGB->data)[i] = *rgb;
+                int count = NES_MIN(_evaluateSprites(y, secondary), 8);
+                _drawSpriteLine(line, y, secondary, count, &begin, &end);
+                
+                for (int x=0; x<DISPLAY_BUFFER_PIXEL_WIDTH; x++)
+                {
+                    int systemPaletteUnitIndex = sprPaletteAddr[line[x] & 15]; // 系统默认调色板颜色索引 [0,63]
+                    RGB* rgb = (RGB*)&DEFAULT_PALETTE[systemPaletteUnitIndex*3];
+                    ((RGB*)_spr_bufferRGB->data)[y*DISPLAY_BUFFER_PIXEL_WIDTH + x] = *rgb;
+                }
             }
         }
         
@@ -637,29 +910,211 @@ namespace ReNes {
         
     private:
         
-        // 精灵溢出检测：当某条扫描线上出现8个以上精灵时，设置精灵溢出标记
-        bool _spriteOverflow(int scanline)
+        //--------------------------------------
+        // I/O寄存器，由 Memory 在CPU访问 $2000-$2007（及镜像）、$4014 时调用
+        
+        void _write2000(uint16_t addr, uint8_t value)
         {
-            int count = 0;
-            int sprHeight = _control_regs->get(5) ? 15 : 7;
+            // t: ...BA.. ........ = d: ......BA
+            _t &= ~(0x3 << 10);
+            _t |= ((value & 0x3) << 10);
             
-            // 扫描所有精灵
-            for (int i=0; i<64; i++)
+            // 每次读写$2007后 _v 增加1或者32
+            _vramIncrement = (value & 0x4) ? 32 : 1;
+        }
+        
+        void _write2003(uint16_t addr, uint8_t value)
+        {
+            _dstAddr2004 = value;
+        }
+        
+        void _write2004(uint16_t addr, uint8_t value)
+        {
+            // 问题1
+//            if (_status_regs->get(7) == 1)
+                _sprram[_dstAddr2004++ % 256] = value;
+        }
+        
+        void _write2005(uint16_t addr, uint8_t value)
+        {
+            if (_w == 0)
             {
-                Sprite* spr = (Sprite*)&_OAM[i*4];
-                if (*(int*)spr == 0) // 没有精灵数据
+                // 低3位写入 _x
+                // 高5位写入 _t 低5位
+                _t &= ~0x1F;
+                _t |= value >> 3;
+                _x = value & 7; // 取低3位
+            }
+            else
+            {
+                // 低3位写入 _t 12~14位
+                // 高5位写入 _t 位5~9
+                _t &= ~0x73E0; // 清理 111 0011 1110 0000
+                _t |= ((value & 0x7) << 12) | ((value >> 3) << 5);
+            }
+            
+            _w = 1 - _w;
+        }
+        
+        void _write2006(uint16_t addr, uint8_t value)
+        {
+            if (_w == 0)
+            {
+                // 低6位写入 _t 的8~13位 并将14位置零
+                _t &= 0xFF;
+                _t |= (value & 0x3F) << 8;
+            }
+            else
+            {
+                // 将8位全部写入 _t 的低8位
+                _t &= ~0xFF;
+                _t |= (value & 0xFF);
+                _v = _t; // 第二次写入会覆盖 _v
+                _2007ReadingStep = 0; // 每次_v生效，忽略从2007读取的第一个字节
+            }
+            _w = 1 - _w;
+        }
+        
+        // 写入$2007之前是否可以不让PPU追上CPU。块内不会跨过预渲染线开始等事件（见 pixelsUntilNextEvent），
+        // 名称表、图案表只在预渲染线开始时（以及渲染期间切换图案表之后）绘制到缓冲区，可见扫描线只读取调色板，
+        // 所以除了调色板，写入的数据在PPU追上之前、之后生效，绘制结果都相同
+        bool _vramWriteDeferrable(uint16_t addr) const
+        {
+            return (_v & 0x3FFF) < VRAM::PALETTE_OFFSET && !_chrDirty && !_bkRowsStale;
+        }
+        
+        void _write2007(uint16_t addr, uint8_t value)
+        {
+            // 在每一次向$2007写数据后，地址会根据$2000的2bit位增加1或者32
+            _vram->write8bitData(_v, value);
+            
+            // 通知
+//            _vramDidUpdasted(_v);
+            
+            // 自动增加
+            _v += _vramIncrement;
+        }
+        
+        void _write4014(uint16_t addr, uint8_t value)
+        {
+            // 源数据可能在PRG ROM中当前映射的bank
+            const uint8_t* src = _mem->pageData(value);
+            if (src)
+            {
+                memcpy(_sprram, src, 256);
+            }
+            else
+            {
+                for (int i=0; i<256; i++)
+                    _sprram[i] = _mem->get8bitData((value << 8) | i);
+            }
+        }
+        
+        void _read2002(uint16_t addr, uint8_t* value, bool* valid)
+        {
+            // 读取 0x2002会重置 _w 状态
+            _w = 0;
+            _2002ReadClearedVblank = _status_regs->get(7);
+            _status_regs->set(7, 0);
+        }
+        
+        void _read2004(uint16_t addr, uint8_t* value, bool* valid)
+        {
+            *value = _sprram[_dstAddr2004++ % 256];
+        }
+        
+        void _read2007(uint16_t addr, uint8_t* value, bool* valid)
+        {
+            // (从调色板之前的地址读取 [0, 3EFF] ) 第一次读取的值是无效的，会缓冲到下一次读取才返回
+            if (_v <= 0x3EFF)
+            {
+                if (_2007ReadingStep == 0)
+                {
+                    *valid = false;
+                }
+                else
+                {
+                    *value = _2007ReadingCache;
+                }
+                
+                _2007ReadingCache = _vram->read8bitData(_v);
+            }
+            else
+            {
+                _2007ReadingCache = _vram->read8bitData(_v);
+//                printf("addr: %x %d\n", _v, _2007ReadingCache);
+                *value = _2007ReadingCache;
+            }
+            
+            _v += _vramIncrement;
+            _2007ReadingStep = 1;
+        }
+        
+        //--------------------------------------
+        
+        // 从当前位置开始，绘制到 line 扫描线上的 x 点（包含）需要的扫描点数，与 pixelsUntilNextEvent 的计算方式相同
+        inline
+        int _pixelsUntil(int line, int x) const
+        {
+            if (line == _scanline_y)
+                return x - _scanline_x + 1;
+            
+            // 跨过扫描线时带入的1个点刚好绘制下一条扫描线的第0个点
+            return (_frame_w - _scanline_x) + (line - 1 - _scanline_y) * (_frame_w - 1) + x;
+        }
+        
+        // 是否是会取图案的扫描线（可见扫描线和预渲染线）
+        inline
+        bool _isFetchLine(int line) const
+        {
+            return line < RENES_FRAME_VISIBLE_H || line == _frame_h-1;
+        }
+        
+        // 当前扫描线上A12上升的点，不会上升时返回-1。
+        // 背景在 [1,256]、[321,336] 取图案，精灵在 [257,320] 取图案。中间只有取名称表的短暂低电平，mapper会过滤掉，
+        // 所以只有背景和精灵使用不同的图案表时，每条扫描线才会有一次上升沿：
+        // 背景 $0000、精灵 $1000 时在取精灵图案的开始（260），背景 $1000、精灵 $0000 时在下一行背景预取的开始（324）
+        inline
+        int _a12RiseDot() const
+        {
+            // 没有渲染时不取图案
+            if (_mask_regs->get(3) == 0 && _mask_regs->get(4) == 0)
+                return -1;
+            
+            // 8x16的精灵由tile决定图案表，一般使用 $1000
+            bool sprHigh = _control_regs->get(5) || _control_regs->get(3);
+            bool bkHigh = _control_regs->get(4);
+            
+            if (sprHigh && !bkHigh)
+                return 260;
+            if (bkHigh && !sprHigh)
+                return 324;
+            return -1;
+        }
+        
+        // 到 mapper 产生IRQ的A12上升沿（包含）需要绘制的扫描点数，超过 limit 时返回 limit。
+        // limit 不会超过当前帧结束，所以只需要查找到最后一条扫描线
+        int _pixelsUntilA12Irq(int limit) const
+        {
+            int rises = _a12Listener->a12RisesUntilIrq();
+            int dot = _a12RiseDot();
+            if (rises <= 0 || dot < 0)
+                return limit;
+            
+            for (int line = _scanline_x > dot ? _scanline_y+1 : _scanline_y; line<_frame_h; line++)
+            {
+                if (!_isFetchLine(line))
                     continue;
                 
-                // 需要判断范围
-                const int start = spr->y-1;
-                const int end   = start + sprHeight;
-                if (scanline >= start && scanline <= end) {
-                    if (count++ > 8)
-                        return true;
-                }
+                int p = _pixelsUntil(line, dot);
+                if (p >= limit)
+                    break;
+                
+                if (--rises == 0)
+                    return p;
             }
             
-            return false;
+            return limit;
         }
         
         void _drawScanline(bool* vblankEvent, int pixelCount)
@@ -680,18 +1135,7 @@ namespace ReNes {
             if (_scanline_y == 0)
                 _currentFrameOver = false;
             
-            if (_scanline_x == 0 && _status_regs->get(5) == 0)
-            {
-                // 检查精灵溢出
-                if (_spriteOverflow(_scanline_y))
-                {
-//                    printf("精灵溢出\n");
-                    _status_regs->set(5, 1);
-                }
-            }
-            
             // 绘制背景
-            const uint8_t* bkPaletteAddr = _bkPaletteAddress();
             const uint8_t* sprPaletteAddr = _sprPaletteAddress();
             
             bool showBg  = this->_showBg;
@@ -704,6 +1148,27 @@ namespace ReNes {
             int line_y = this->_scanline_y; // 使用了再增加
             if (line_y <= 239) // 只绘制可见扫描线
             {
+                // 渲染期间切换了图案表，用新的图案重新绘制（已经显示的扫描线不受影响）
+                // MMC2/MMC4的锁存器按取tile的顺序变化，背景全部重新绘制；其他情况在扫描线用到某一行tile时再绘制这一行（见 _renderNameTableRow）
+                if (_chrDirty)
+                {
+                    _prepareSprites();
+                    
+                    if (_chrLatchEnabled)
+                        _renderNameTables();
+                    else
+                        _bkRowsStale = true;
+                    
+                    _chrDirty = false;
+                    
+                    if (_scanline_x != 0)
+                        _drawSpriteLine(_sprLine, line_y, _secondaryOAM, _secondaryCount, &_sprLineBegin, &_sprLineEnd);
+                }
+                
+                // 扫描线开始时求值这条扫描线上的精灵
+                if (_scanline_x == 0)
+                    _evaluateScanline(line_y);
+                
                 // 从 _t 中取出tile坐标偏移，相当于表中的起始位置
                 int bk_offset_x = v & 0x1F;         // tile整体偏移[0,31]
                 int bk_offset_y = (v >> 5) & 0x1F;
@@ -727,6 +1192,9 @@ namespace ReNes {
                 int bk_tile_y = (line_y + bk_t_y)/8 + bk_offset_y; // [屏幕扫描]
                 int tile_y = bk_tile_y % 30; // 30个tile 垂直循环
                 
+                if (_bkRowsStale)
+                    _renderNameTableRow(tile_y);
+                
                 //                int ty = line_y%8; // [瓦片扫描]
                 int ty = (line_y+bk_t_y)%8; // [屏幕扫描]
                 // int draw_line_y = line_y/8*8-bk_t_y;
@@ -746,205 +1214,188 @@ namespace ReNes {
                 // 宽度应该是256，刚好填满32个tile。但是如果发生错位的情况，是需要33个tile
                 //const static int LINE_X_MAX = 33*8; [瓦片扫描]
                 int line_x_max = fminf(_scanline_x+pixelCount-1, RENES_FRAME_VISIBLE_W - 1);
-                for (int line_x=_scanline_x; line_x <= line_x_max; line_x++)
+                int count = line_x_max - _scanline_x + 1;
+                if (count > 0)
                 {
-                    int tx = (line_x+bk_t_x)%8; // [屏幕扫描] 对应当前瓦片上的index
-                    //                    int tx = line_x%8; // [瓦片扫描] 对应当前瓦片上的index
-                    /// int draw_line_x = line_x/8*8-bk_t_x; // 背景绘制的整体起始点
-                    // int dst_x = draw_line_x + tx; // 屏幕上的坐标
-                    // [瓦片扫描]
-                    //                    if (dst_x >= 256)
-                    //                        continue;
-                    //
-                    //                    if (dst_x < 0)
-                    //                    {
-                    //                        continue;
-                    //                    }
-                    
-
-                    
-                    int first_tile_x = (line_x + bk_t_x)/8 + bk_offset_x; // [屏幕扫描]
-                    
-                    // 从基础名称表开始绘制，并根据tile偏移+瓦片索引
-                    int nameTableIndex = ((firstNameTableIndex + first_tile_x/32) % 2);
-                    
-                    // int bk_tile_x = line_x/8 + bk_offset_x; // [瓦片扫描] 当前位置的tile
-                    // 32个tile 水平循环在屏幕上的对应瓦片坐标，用来定位在对应（当前/下一个）名称表里的位置，确定tileIndex
-                    int tile_x = first_tile_x % 32;
-                    
-                    int bk_systemPaletteUnitIndex;
-                    
-                    int bk_peletteIndex;
-                    
 #ifndef RENES_BK_MODE_OPT
+                    // 这一段像素的背景调色板下标
+                    uint8_t bkLine[RENES_FRAME_VISIBLE_W];
+                    for (int line_x=_scanline_x; line_x <= line_x_max; line_x++)
                     {
-                        const uint8_t* bkPetternTableAddr = _bkPetternTableAddress();
+                        int tx = (line_x+bk_t_x)%8; // [屏幕扫描] 对应当前瓦片上的index
+                        //                    int tx = line_x%8; // [瓦片扫描] 对应当前瓦片上的index
+                        /// int draw_line_x = line_x/8*8-bk_t_x; // 背景绘制的整体起始点
+                        // int dst_x = draw_line_x + tx; // 屏幕上的坐标
+                        // [瓦片扫描]
+                        //                    if (dst_x >= 256)
+                        //                        continue;
+                        //
+                        //                    if (dst_x < 0)
+                        //                    {
+                        //                        continue;
+                        //                    }
                         
-                        // 背景不支持tile翻转，精灵才支持，这里作差别提示
-                         bool flipV = false;
-                         bool flipH = false;
-                         int tx_ = flipH ? tx : 7-tx;
-                         int ty_ = flipV ? 7-ty : ty;
                         
-                        /*
-                         调色板
-                         0x3F00 16字节
-                         */
-                        /* 调色板索引 [16]颜色
-                         11 11
-                         高2bit: 属性表
-                         低2bit: 来自图案表 <- 名称表
-                         */
-                        struct PaletteIndex{
-                            int high2bit;
-                            int low2bit;
-                            inline
-                            int merge() const
-                            {
-                                return (high2bit << 2) + low2bit;
-                            }
-                        };
                         
-                        PaletteIndex peletteIndex;
+                        int first_tile_x = (line_x + bk_t_x)/8 + bk_offset_x; // [屏幕扫描]
+                        
+                        // 从基础名称表开始绘制，并根据tile偏移+瓦片索引
+                        int nameTableIndex = ((firstNameTableIndex + first_tile_x/32) % 2);
+                        
+                        // int bk_tile_x = line_x/8 + bk_offset_x; // [瓦片扫描] 当前位置的tile
+                        // 32个tile 水平循环在屏幕上的对应瓦片坐标，用来定位在对应（当前/下一个）名称表里的位置，确定tileIndex
+                        int tile_x = first_tile_x % 32;
+                        
+                        int bk_peletteIndex;
+                    
                         {
-                            // 未处理左右镜像，需要计算s_y
+                            // 背景不支持tile翻转，精灵才支持，这里作差别提示
+                             bool flipV = false;
+                             bool flipH = false;
+                             int tx_ = flipH ? tx : 7-tx;
+                             int ty_ = flipV ? 7-ty : ty;
                             
-                            /* 名称表
-                             $2000-$23FF    $0400    Nametable 0
-                             $2400-$27FF    $0400    Nametable 1
-                             $2800-$2BFF    $0400    Nametable 2
-                             $2C00-$2FFF    $0400    Nametable 3
+                            /*
+                             调色板
+                             0x3F00 16字节
+                             */
+                            /* 调色板索引 [16]颜色
+                             11 11
+                             高2bit: 属性表
+                             低2bit: 来自图案表 <- 名称表
                              */
-                            const uint8_t* nameTableAddr = _nameTableAddress(nameTableIndex);
+                            struct PaletteIndex{
+                                int high2bit;
+                                int low2bit;
+                                inline
+                                int merge() const
+                                {
+                                    return (high2bit << 2) + low2bit;
+                                }
+                            };
+                            
+                            PaletteIndex peletteIndex;
                             {
-                                // 名称表是32x30连续空间，960字节，每个字节是一个索引，表示[0,255]的数
-                                // 可以定位256个瓦片的地址（瓦片：图案表中的单位）
-                                int tileIndex = nameTableAddr[tile_y*32 + tile_x]; // 得到 bkg tile index
+                                // 未处理左右镜像，需要计算s_y
                                 
-                                /* 图案表：一个4KB的空间，PPU有两个图案表，映射在VRAM里 供背景和精灵使用
-                                 $0000-$0FFF    $1000    Pattern table 0
-                                 $1000-$1FFF    $1000    Pattern table 1
-                                 
-                                 确定在图案表里的tile地址，每个tile控制8x8像素（64个像素），8字节一组，共2组，16字节
-                                 两组8字节
-                                 64bit: 11111111 11111111 11111111 11111111 11111111 11111111 11111111 11111111
-                                 64bit: 11111111 11111111 11111111 11111111 11111111 11111111 11111111 11111111
-                                 1 (低)
-                                 1 (高)
-                                 构成2bit
+                                /* 名称表
+                                 $2000-$23FF    $0400    Nametable 0
+                                 $2400-$27FF    $0400    Nametable 1
+                                 $2800-$2BFF    $0400    Nametable 2
+                                 $2C00-$2FFF    $0400    Nametable 3
                                  */
+                                const uint8_t* nameTableAddr = _nameTableAddress(nameTableIndex);
+                                {
+                                    // 名称表是32x30连续空间，960字节，每个字节是一个索引，表示[0,255]的数
+                                    // 可以定位256个瓦片的地址（瓦片：图案表中的单位）
+                                    int tileIndex = nameTableAddr[tile_y*32 + tile_x]; // 得到 bkg tile index
+                                    
+                                    /* 图案表：一个4KB的空间，PPU有两个图案表，映射在VRAM里 供背景和精灵使用
+                                     $0000-$0FFF    $1000    Pattern table 0
+                                     $1000-$1FFF    $1000    Pattern table 1
+                                     
+                                     确定在图案表里的tile地址，每个tile控制8x8像素（64个像素），8字节一组，共2组，16字节
+                                     两组8字节
+                                     64bit: 11111111 11111111 11111111 11111111 11111111 11111111 11111111 11111111
+                                     64bit: 11111111 11111111 11111111 11111111 11111111 11111111 11111111 11111111
+                                     1 (低)
+                                     1 (高)
+                                     构成2bit
+                                     */
+                                    
+                                    const uint8_t* bkTile = _bkTile(tileIndex);
+                                    {
+                                        // 图案表tile 第一字节与第八字节对应的bit位，组成这一像素颜色的低2位（最后构成一个[0,63]的数，索引到系统默认的64种颜色）
+                                        peletteIndex.low2bit = bkTile[ty_*8 + 7-tx_];
+                                    }
+                                }
                                 
-                                const uint8_t* bkTileAddr = &bkPetternTableAddr[tileIndex * 16];
+                                /*
+                                 属性表 - 位于名称表未使用的64字节空间
+                                 64字节 = 名称表0x400(1024)-960(32x30)
+                                 影响tile组: 4x4(i8x8)
+                                 32x30 / (4x4) = 8x7.5
+                                 */
+                                const uint8_t* attributeTableAddr = _attributeTableAddress(nameTableIndex);
                                 {
-                                    // 图案表tile 第一字节与第八字节对应的bit位，组成这一像素颜色的低2位（最后构成一个[0,63]的数，索引到系统默认的64种颜色）
-                                    int low0 = ((bit8*)&bkTileAddr[ty_])->get(tx_);
-                                    int low1 = ((bit8*)&bkTileAddr[ty_+8])->get(tx_);
-                                    peletteIndex.low2bit = low0 | (low1 << 1);
+                                    // 一个字节表示4x4的tile组，先确定当前(x,y)所在字节（即属性）
+                                    // 每2bit用于2x2的tile，作为peletteIndex的高2位
+                                    uint8_t attributeAddrFor4x4Tile = attributeTableAddr[(tile_y / 4 * (32/4) + tile_x / 4)];
+                                    // 换算tile(x,y)所使用的bit位
+                                    int bit = (tile_y % 4) / 2 * 4 + (tile_x % 4) / 2 * 2;
+                                    peletteIndex.high2bit = (attributeAddrFor4x4Tile >> bit) & 0x3;
                                 }
                             }
-                            
-                            /*
-                             属性表 - 位于名称表未使用的64字节空间
-                             64字节 = 名称表0x400(1024)-960(32x30)
-                             影响tile组: 4x4(i8x8)
-                             32x30 / (4x4) = 8x7.5
-                             */
-                            const uint8_t* attributeTableAddr = _attributeTableAddress(nameTableIndex);
-                            {
-                                // 一个字节表示4x4的tile组，先确定当前(x,y)所在字节（即属性）
-                                // 每2bit用于2x2的tile，作为peletteIndex的高2位
-                                uint8_t attributeAddrFor4x4Tile = attributeTableAddr[(tile_y / 4 * (32/4) + tile_x / 4)];
-                                // 换算tile(x,y)所使用的bit位
-                                int bit = (tile_y % 4) / 2 * 4 + (tile_x % 4) / 2 * 2;
-                                peletteIndex.high2bit = (attributeAddrFor4x4Tile >> bit) & 0x3;
-                            }
+                            bk_peletteIndex = peletteIndex.merge();
                         }
-                        bk_peletteIndex = peletteIndex.merge();
+                        bkLine[line_x - _scanline_x] = bk_peletteIndex;
                     }
+                    
+                    const uint8_t* bkFirst = bkLine;
+                    const uint8_t* bkSecond = bkLine + count;
+                    int first = count;
 #else
                     // 优化模式：直接使用_scrollBuffer已经计算好的调色表下标数据
-                    {
-                        // 瓦片绝对坐标 = 屏幕坐标 + 瓦片偏移(含精细偏移)
-                        // 当前模式：名称表分屏
-                        // 需要直接加名称表虚拟起始坐标即可: 名称表坐标 + 瓦片偏移(含精细偏移)
-                        const static int NameTablePosition[] = {
-                            0,0, 256,0,
-                            0,240, 256,240
-                        };
-                        const int *map_table_pos = &NameTablePosition[nameTableIndex*2];
-                        
-                        int map_pos_x = map_table_pos[0] + tile_x*8 + tx;
-                        int map_pos_y = map_table_pos[1] + tile_y*8 + ty;
+                    // 瓦片绝对坐标 = 屏幕坐标 + 瓦片偏移(含精细偏移)
+                    // 名称表0、1在_scrollBuffer里左右相邻，每行512个像素水平循环，所以最多分成两段连续的数据
+                    const uint8_t* row = _scrollBuffer + (tile_y*8 + ty)*512;
+                    int pos = (firstNameTableIndex*256 + bk_offset_x*8 + bk_t_x + _scanline_x) % 512;
                         
-                        bk_peletteIndex = _scrollBuffer[map_pos_y*512 + map_pos_x];
-                    }
+                    const uint8_t* bkFirst = row + pos;
+                    const uint8_t* bkSecond = row;
+                    int first = NES_MIN(count, 512 - pos);
 #endif
                     
-                    bk_systemPaletteUnitIndex = bkPaletteAddr[bk_peletteIndex]; // 系统默认调色板颜色索引 [0,63]
+                    int pixelIndex = line_y * 32*8 + _scanline_x; // [屏幕扫描]
+                    const uint8_t* sprLine = &_sprLine[_scanline_x];
+                    
+                    // 这一段中有精灵的范围 [sprBegin, sprEnd)，其余的像素只绘制背景
+                    int sprBegin = NES_MAX(_sprLineBegin - _scanline_x, 0);
+                    int sprEnd = NES_MIN(_sprLineEnd - _scanline_x, count);
+                    if (!showSpr || sprBegin >= sprEnd)
                     {
-                        int pixelIndex = (line_y * 32*8 + line_x); // [屏幕扫描] 最低位是右边第一像素，所以渲染顺序要从右往左
-                        
-                        // 获取当前像素的精灵数据，并检测碰撞
-                        int spr_systemPaletteUnitIndex = 0; // 取低6位[0,63]
-                        bool sprFront = true;
+                        sprBegin = count;
+                        sprEnd = count;
+                    }
+                    
+                    // 碰撞检测 (必须同时显示背景和精灵的情况下)
+                    if (showSpr && showBg && _status_regs->get(6) == 0)
+                    {
+                        // 编号小的精灵在上面，精灵0的像素不会被其他精灵覆盖
+                        for (int i=sprBegin; i<sprEnd; i++)
                         {
-                            uint8_t& spr_data = _spr_buffer[pixelIndex];
+                            uint8_t spr0data = sprLine[i];
+                            bool isFirstSprite = spr0data > 31; // 即第5bit非0
+                            int sprPaletteIndex = spr0data & 15;   // 前4bit
                             
-                            if (spr_data != 0)
-                            {
-                                sprFront = (spr_data & 0x10) == 0; // 即第4bit为0
-                                spr_systemPaletteUnitIndex = sprPaletteAddr[spr_data & 15];
-                                
-                                // 碰撞检测 (必须同时显示背景和精灵的情况下)
-                                if (showSpr && showBg)
-                                {
-                                    // 精灵0单独使用一个全屏buffer
-                                    uint8_t spr0data = _spr0buffer[pixelIndex];
-                                    bool isFirstSprite = spr0data > 31; // 即第5bit非0
-                                    int sprPaletteIndex = spr0data & 15;   // 前4bit
-                                    
-                                     // 使用精灵0来检测碰撞
-                                    int sysPaletteIndex = sprPaletteAddr[sprPaletteIndex];
-                                    
-                                    // 碰撞条件，第一精灵 & 非0调色板第一位（透明色）& 允许碰撞
-                                    if (isFirstSprite && sysPaletteIndex != sprPaletteAddr[0] && _status_regs->get(6) == 0)
-                                    {
-                                        _status_regs->set(6, 1);
-                                    }
-                                }
-                            }
-                        }
-                        
-                        int systemPaletteUnitIndex = -1;
-                        {
-                            if (showSpr && spr_systemPaletteUnitIndex != 0)
-                            {
-                                // 判断前后
-                                if (showBg && !sprFront && bk_peletteIndex != 0)
-                                {
-                                    systemPaletteUnitIndex = bk_systemPaletteUnitIndex;
-                                }
-                                else
-                                {
-                                    systemPaletteUnitIndex = spr_systemPaletteUnitIndex;
-                                }
-                            }
-                            else if (showBg)
+                            // 使用精灵0来检测碰撞
+                            int sysPaletteIndex = sprPaletteAddr[sprPaletteIndex];
+                            
+                            // 碰撞条件，第一精灵 & 非0调色板第一位（透明色）
+                            if (isFirstSprite && sysPaletteIndex != sprPaletteAddr[0])
                             {
-                                systemPaletteUnitIndex = bk_systemPaletteUnitIndex;
+                                _status_regs->set(6, 1);
+                                break;
                             }
                         }
-                        
-                        auto* pb = (RGB*)&display_buffer[pixelIndex*3];
-                        if (systemPaletteUnitIndex != -1)
-                        {
-                            RGB* rgb = (RGB*)&DEFAULT_PALETTE[systemPaletteUnitIndex*3];
-                            *pb = *rgb;
-                        }
                     }
+                    
+                    // 按前后优先级合成背景和精灵，写入RGB
+                    uint8_t* pb = &display_buffer[pixelIndex*3];
+                    _composeSpan(pb, bkFirst, bkSecond, first, sprLine, 0, sprBegin, showBg, false);
+                    _composeSpan(pb, bkFirst, bkSecond, first, sprLine, sprBegin, sprEnd, showBg, showSpr);
+                    _composeSpan(pb, bkFirst, bkSecond, first, sprLine, sprEnd, count, showBg, false);
                 }
             }
             
+            // A12上升沿
+            if (_a12Listener && _isFetchLine(_scanline_y))
+            {
+                int dot = _a12RiseDot();
+                if (dot >= _scanline_x && dot < _scanline_x + pixelCount)
+                    _a12Listener->a12Rise();
+            }
+            
             _scanline_x += pixelCount;
             
             // 奇数帧，跳过最后一条扫描的最后一个点
@@ -981,23 +1432,12 @@ namespace ReNes {
         
         // 检查图案是否使用了该调色板下标
         inline
-        bool isUsedPaletteIndex(const uint8_t* bkTileAddr, int paletteIndex_low2bit) const
+        bool isUsedPaletteIndex(const uint8_t* bkTile, int paletteIndex_low2bit) const
         {
-            //const uint8_t* bkTileAddr = &bkPetternTableAddr[tileIndex * 16];
+            for (int i=0; i<VRAM::TILE_PIXELS; i++)
             {
-                for (int i=0; i<64; i++)
-                {
-                    int ty_ = i/8;
-                    int tx_ = i%8;
-                    {
-                        // 图案表tile 第一字节与第八字节对应的bit位，组成这一像素颜色的低2位（最后构成一个[0,63]的数，索引到系统默认的64种颜色）
-                        int low0 = ((bit8*)&bkTileAddr[ty_])->get(tx_);
-                        int low1 = ((bit8*)&bkTileAddr[ty_+8])->get(tx_);
-                        int low2bit = low0 | (low1 << 1);
-                        if (low2bit == paletteIndex_low2bit)
-                            return true;
-                    }
-                }
+                if (bkTile[i] == paletteIndex_low2bit)
+                    return true;
             }
             return false;
         }
@@ -1005,13 +1445,11 @@ namespace ReNes {
         // 更新所有使用了目标调色板下标的tile
         void updateBackgroundTile(int nameTableIndex, int paletteIndex)
         {
-            const uint8_t* bkPetternTableAddr = _bkPetternTableAddress();
             const uint8_t* addr = _vram->nameTableAddress(nameTableIndex);
             int paletteIndex_low2bit = paletteIndex & 0x3;
             for (int ti = 0; ti < 32*30; ti++)
             {
-                const uint8_t* bkTileAddr = &bkPetternTableAddr[addr[ti] * 16];
-                if (isUsedPaletteIndex(bkTileAddr, paletteIndex_low2bit))
+                if (isUsedPaletteIndex(_bkTile(addr[ti]), paletteIndex_low2bit))
                 {
                     updateBackgroundTile(nameTableIndex, ti%32, ti/32);
                 }
@@ -1020,6 +1458,12 @@ namespace ReNes {
         
         // 更新指定位置的tile
         void updateBackgroundTile(int nameTableIndex, int tile_x, int tile_y, int tile_x_count=1, int tile_y_count=1)
+        {
+            _updateBackgroundTile(nameTableIndex, nameTableIndex, tile_x, tile_y, tile_x_count, tile_y_count);
+        }
+        
+        // 按名称表 tableIndex 绘制tile到 _scrollBuffer 中第 region 个名称表的位置
+        void _updateBackgroundTile(int region, int tableIndex, int tile_x, int tile_y, int tile_x_count, int tile_y_count)
         {
             int stride = DISPLAY_BUFFER_PIXEL_WIDTH * 2; // 水平是两个缓冲区排列的，所以这里要 x2
             const static int offset[] = {
@@ -1027,11 +1471,11 @@ namespace ReNes {
                 2*DISPLAY_BUFFER_PIXEL_CONUT, 2*DISPLAY_BUFFER_PIXEL_CONUT+DISPLAY_BUFFER_PIXEL_WIDTH
             };
             
-            drawBackground(_scrollBuffer + offset[nameTableIndex], stride, tile_x, tile_y, tile_x_count, tile_y_count, nameTableIndex, _bkPetternTableAddress(), _bkPaletteAddress());
+            drawBackground(_scrollBuffer + offset[region], stride, tile_x, tile_y, tile_x_count, tile_y_count, tableIndex);
         }
         
-        // 绘制瓦片到缓冲区
-        void drawTile(uint8_t* buffer, int stride, int x, int y, int high2, const uint8_t* tileAddr, const uint8_t* paletteAddr)
+        // 绘制瓦片到缓冲区，tile 是解码后的像素（见 VRAM::decodedTile）
+        void drawTile(uint8_t* buffer, int stride, int x, int y, int high2, const uint8_t* tile)
         {
             for (int ty=0; ty<8; ty++)
             {
@@ -1040,8 +1484,7 @@ namespace ReNes {
                 if (dst_y < 0 || dst_y >= RENES_FRAME_VISIBLE_H)
                     continue;
                 
-                // int ty_ = flipV ? 7-ty : ty;
-                int ty_ = ty;
+                const uint8_t* row = &tile[ty * 8];
                 
                 for (int tx=0; tx<8; tx++)
                 {
@@ -1050,16 +1493,8 @@ namespace ReNes {
                     if (dst_x < 0 || dst_x >= RENES_FRAME_VISIBLE_W)
                         continue;
                     
-                    // int tx_ = flipH ? tx : 7-tx;
-                    int tx_ = 7-tx;
-                    
-                    // tile 第一字节与第八字节对应的bit位，组成这一像素颜色的低2位（构成调色板下标[16]）
-                    int low0 = ((bit8*)&tileAddr[ty_])->get(tx_);
-                    int low1 = ((bit8*)&tileAddr[ty_+8])->get(tx_);
-                    int low2 = low0 | (low1 << 1);
-                    
                     // 4bit
-                    int paletteUnitIndex = (high2 << 2) + low2; // 背景调色板单元索引号
+                    int paletteUnitIndex = (high2 << 2) + row[tx]; // 背景调色板单元索引号
                     
                     // 向缓冲区写入调色表下标
                     int bpp = 1;
@@ -1070,129 +1505,8 @@ namespace ReNes {
             }
         };
         
-        // 绘制精灵到缓冲区
-        void drawSprBuffer(uint8_t* buffer, int x, int y, int high2, const uint8_t* tileAddr, const uint8_t* paletteAddr, bool flipH, bool flipV, bool isFirstSprite, bool priority)
-        {
-            bool mode8x16 = _control_regs->get(5);
-            
-            if (!mode8x16)
-            {
-                for (int ty=0; ty<8; ty++)
-                {
-                    int dst_y = y + ty; // 屏幕上的坐标y
-                    if (dst_y < 0 || dst_y >= RENES_FRAME_VISIBLE_H)
-                        continue;
-                    
-                    int ty_ = flipV ? 7-ty : ty; // 内部数据坐标转换
-                    
-                    const bit8* low0_tileAddr = (const bit8*)&tileAddr[ty_];
-                    const bit8* low1_tileAddr = low0_tileAddr+8;
-                    
-                    for (int tx=0; tx<8; tx++)
-                    {
-                        int dst_x = x + tx; // 屏幕上的坐标x
-                        if (dst_x < 0 || dst_x >= RENES_FRAME_VISIBLE_W)
-                            continue;
-                        
-                        /*
-                         x (0-7)
-                                 像素 0123 4567
-                                 bit 7654 3210
-                         8bit: (高位) 1111 1111 (低位)
-                         8bit: (高位) 1111 1111 (低位)
-                         最低位是右边第一像素，所以内部数据坐标要颠倒
-                         */
-                        int tx_ = flipH ? tx : 7-tx;
-                        
-                        // tile 第一字节与第八字节对应的bit位，组成这一像素颜色的低2位（最后构成一个[0,63]的数，索引到系统默认的64种颜色）
-                        int low0 = low0_tileAddr->get(tx_);
-                        int low1 = low1_tileAddr->get(tx_);
-                        int low2 = low0 | (low1 << 1);
-                        
-                        int paletteUnitIndex = (high2 << 2) + low2; // 背景调色板单元索引号 [0, 15]
-                        
-                        // 如果绘制精灵，而且当前颜色引用到背景透明色（背景调色板第一位），就不绘制
-                        if (paletteUnitIndex % 4 == 0)
-                        {
-                            continue;
-                        }
-                        
-                        // 根据dst_y和dst_x来确定像素索引，缓冲区中表示的是 1字节/1像素
-                        // 所以stride是256
-                        int pixelIndex = dst_y*RENES_FRAME_VISIBLE_W + dst_x;
-                        // 11 11 1111
-                        // 6、7bit: 未使用
-                        // 5 bit: 第一精灵标记
-                        // 4 bit: 前置精灵标记
-                        // 低4bit: [16]调色板下标
-                        int spr_data = (isFirstSprite ? (3 << 5) : 0) | (priority << 4) | paletteUnitIndex;
-                        
-                        buffer[pixelIndex] = spr_data;
-                    }
-                }
-            }
-            else
-            {
-                
-                for (int ty=0; ty<16; ty++)
-                {
-                    int dst_y = y + ty; // 屏幕上的坐标y
-                    if (dst_y < 0 || dst_y >= RENES_FRAME_VISIBLE_H)
-                        continue;
-                    
-                    int ty_ = flipV ? 15-(ty%8) : ty; // 内部数据坐标转换
-                    int tileAddrOffset = ty_ >= 8 ? 16 : 0;
-                    
-                    const bit8* low0_tileAddr = (const bit8*)&tileAddr[tileAddrOffset + (ty_%8)];
-                    const bit8* low1_tileAddr = low0_tileAddr+8;
-                    
-                    for (int tx=0; tx<8; tx++)
-                    {
-                        int dst_x = x + tx; // 屏幕上的坐标x
-                        if (dst_x < 0 || dst_x >= RENES_FRAME_VISIBLE_W)
-                            continue;
-                        
-                        /*
-                         x (0-7)
-                                 像素 0123 4567
-                                 bit 7654 3210
-                         8bit: (高位) 1111 1111 (低位)
-                         8bit: (高位) 1111 1111 (低位)
-                         最低位是右边第一像素，所以内部数据坐标要颠倒
-                         */
-                        int tx_ = flipH ? tx : 7-tx;
-                        
-                        // tile 第一字节与第八字节对应的bit位，组成这一像素颜色的低2位（最后构成一个[0,63]的数，索引到系统默认的64种颜色）
-                        int low0 = low0_tileAddr->get(tx_);
-                        int low1 = low1_tileAddr->get(tx_);
-                        int low2 = low0 | (low1 << 1);
-                        
-                        int paletteUnitIndex = (high2 << 2) + low2; // 背景调色板单元索引号 [0, 15]
-                        
-                        // 如果绘制精灵，而且当前颜色引用到背景透明色（背景调色板第一位），就不绘制
-                        if (paletteUnitIndex % 4 == 0)
-                        {
-                            continue;
-                        }
-                        
-                        // 根据dst_y和dst_x来确定像素索引，缓冲区中表示的是 1字节/1像素
-                        // 所以stride是256
-                        int pixelIndex = dst_y*RENES_FRAME_VISIBLE_W + dst_x;
-                        // 11 11 1111
-                        // 6、7bit: 未使用
-                        // 5 bit: 第一精灵标记
-                        // 4 bit: 前置精灵标记
-                        // 低4bit: [16]调色板下标
-                        int spr_data = (isFirstSprite ? (3 << 5) : 0) | (priority << 4) | paletteUnitIndex;
-                        
-                        buffer[pixelIndex] = spr_data;
-                    }
-                }
-            }
-        };
-        
         // 从第nameTableIndex个名称表开始绘制（竖直镜像）
-        void drawBackground(uint8_t* buffer, int stride, int tile_x_start, int tile_y_start, int tile_x_count, int tile_y_count, int tableIndex, const uint8_t* bkPetternTableAddr, const uint8_t* bkPaletteAddr){
+        void drawBackground(uint8_t* buffer, int stride, int tile_x_start, int tile_y_start, int tile_x_count, int tile_y_count, int tableIndex){
             
             // 背景的tile偏移（图案表中的tile偏移）
             int bk_offset_x = 0;
@@ -1226,43 +1540,97 @@ namespace ReNes {
                     
                     int tileIndex = nameTableAddr[tile_y*32 + tile_x]; // 得到 bkg tile index
                     
-                    // 确定在图案表里的tile地址，每个tile是8x8像素，占用16字节。
-                    // 前8字节(8x8) + 后8字节(8x8)
-                    const uint8_t* tileAddr = &bkPetternTableAddr[tileIndex * 16];
+                    // 图案表里的tile解码后的8x8像素
+                    const uint8_t* tile = _bkTile(tileIndex);
                     
-                    drawTile(buffer, stride, bk_x*8, bk_y*8, high2, tileAddr, bkPaletteAddr);
+                    drawTile(buffer, stride, bk_x*8, bk_y*8, high2, tile);
+                    
+                    // 这个tile本身使用切换前的图案
+                    if (_chrLatchEnabled)
+                        _fetchChrLatch(_control_regs->get(4), tileIndex);
                 }
             }
         };
         
-        // 背景图案表地址
-        // 图案表：256*16(4KB)的空间
-        const uint8_t* _bkPetternTableAddress() const
+        // 合成一段像素中的 [begin, end) 到 rgb，背景调色板下标是 bkFirst 的前 first 个像素，之后接着 bkSecond（_scrollBuffer 的一行水平循环）
+        inline
+        void _composeSpan(uint8_t* rgb, const uint8_t* bkFirst, const uint8_t* bkSecond, int first, const uint8_t* spr, int begin, int end, bool showBg, bool showSpr)
+        {
+            const uint8_t* bkPaletteAddr = _bkPaletteAddress();
+            const uint8_t* sprPaletteAddr = _sprPaletteAddress();
+            
+            if (begin < first && begin < end)
+            {
+                int count = NES_MIN(end, first) - begin;
+                Compose::scanline(composeKernel, rgb + begin*3, bkFirst + begin, spr + begin, count, bkPaletteAddr, sprPaletteAddr, DEFAULT_PALETTE, showBg, showSpr);
+            }
+            
+            int secondBegin = NES_MAX(begin, first);
+            if (secondBegin < end)
+            {
+                Compose::scanline(composeKernel, rgb + secondBegin*3, bkSecond + (secondBegin - first), spr + secondBegin, end - secondBegin, bkPaletteAddr, sprPaletteAddr, DEFAULT_PALETTE, showBg, showSpr);
+            }
+        }
+        
+        // 是否在渲染中（预渲染线开始之后到可见扫描线结束），这时修改图案表需要重新绘制
+        inline
+        bool _isRendering() const
+        {
+            return _scanline_y < RENES_FRAME_VISIBLE_H || (_scanline_y == _frame_h-1 && _scanline_x > 0);
+        }
+        
+        // 按锁存器的状态映射4KB图案表，返回映射是否发生了变化
+        bool _mapChrLatch(int table)
+        {
+            int bank = _chrLatchBanks[table][_chrLatch[table] == 0xFE];
+            
+            bool changed = false;
+            for (int i=0; i<4; i++)
+                changed |= _vram->mapChrPage(table * 4 + i, bank * 4 + i);
+            return changed;
+        }
+        
+        inline
+        void _setChrLatch(int table, uint8_t value)
+        {
+            if (_chrLatch[table] != value)
+            {
+                _chrLatch[table] = value;
+                _mapChrLatch(table);
+            }
+        }
+        
+        // 取到tile时更新锁存器（MMC2在 $xFD8、$xFE8，MMC4在 $xFD8-$xFDF、$xFE8-$xFEF，按tile处理时两者相同）
+        inline
+        void _fetchChrLatch(int table, int tileIndex)
+        {
+            if (tileIndex == 0xFD || tileIndex == 0xFE)
+                _setChrLatch(table, tileIndex);
+        }
+        
+        // 背景tile解码后的像素
+        // 图案表：256*16(4KB)的空间，按1KB分页映射
+        inline
+        const uint8_t* _bkTile(int tileIndex) const
         {
             // 第4bit决定背景图案表地址 0x0000或0x1000
-            return _vram->petternTableAddress(_control_regs->get(4));
+            return _vram->decodedTile(_control_regs->get(4), tileIndex);
         }
         
-        // 精灵图案表地址
-        // 图案表：256*16(4KB)的空间
-        const uint8_t* _sprPetternTableAddress(int spriteID) const
+        // 精灵tile解码后的像素，half 为1时是8x16精灵的下半部分
+        // 图案表：256*16(4KB)的空间，按1KB分页映射
+        const uint8_t* _sprTile(int spriteID, int half, bool flipH) const
         {
-            // 第3bit决定精灵图案表地址 0x0000或0x1000, 8x16模式下忽略，直接用0x0000
+            // 第3bit决定精灵图案表地址 0x0000或0x1000, 8x16模式下忽略，由tile的第0bit决定
             bool mode8x16 = _control_regs->get(5);
             if (!mode8x16)
             {
-                return _vram->petternTableAddress(_control_regs->get(3)) + spriteID*16;
+                return _vram->decodedTile(_control_regs->get(3), spriteID, flipH);
             }
             else
             {
-                if (spriteID % 2 == 0)
-                {
-                    return _vram->petternTableAddress(0) + spriteID/2*32;
-                }
-                else
-                {
-                    return _vram->petternTableAddress(1) + (spriteID-1)/2*32;
-                }
+                // 两个tile连续存放，偶数tile开始
+                return _vram->decodedTile(spriteID % 2, (spriteID & 0xFE) + half, flipH);
             }
         }
         const uint8_t* _bkPaletteAddress() const { return _vram->bkPaletteAddress(); }
@@ -1302,6 +1670,8 @@ namespace ReNes {
             _dstAddr2004 = 0;
             
             memset(_sprram, 0, 256);
+            
+            _bkRedrawAll = true;
         }
         
         uint16_t _t; // 临时 VRAM 地址
@@ -1321,10 +1691,6 @@ namespace ReNes {
         bool _showBg;
         bool _showSpr;
         
-        // 建立 w * h * 8 的缓冲区，每像素8字节，用来存储8个精灵的数据。
-        // 如果该像素没有精灵，甚至没有叠加，则该位第一字节为0
-        const int SPR_BUFFER_LENGTH = DISPLAY_BUFFER_PIXEL_CONUT;
-        
         uint8_t* _display_buffer = 0;   // 显示缓冲区
         uint8_t* _scrollBuffer = 0;     // 卷轴缓冲区，每个像素存储4bit数[0,15]，用来定位背景调色板。数据单位：每个像素1字节。
         RGB_Buffer* _scrollBufferRGB = 0;
@@ -1332,13 +1698,37 @@ namespace ReNes {
         
         uint8_t _sprram[256]; // 精灵内存, 64 个，每个4字节
         uint8_t _OAM[256];    // 每帧的OAM
-        uint8_t* _spr_buffer = 0;   // 精灵绘制缓冲区
-        uint8_t* _spr0buffer;       // 0号精灵缓冲区
+        int _sprHeight = 8;                 // 当前帧精灵的高度，8或16
+        uint8_t _sprRows[64][16 * 8];       // 每个精灵逐行的像素数据（见 _prepareSprites），没有像素的位置为0
+        uint8_t _sprRowMasks[64][16];       // 每行不透明像素的位图，第n位是第n个像素
+        uint8_t _secondaryOAM[8];           // 当前扫描线上的精灵编号（次级OAM）
+        int _secondaryCount = 0;
+        uint8_t _sprLine[RENES_FRAME_VISIBLE_W + 8] = {}; // 当前扫描线的精灵数据，格式同 _sprRows
+        int _sprLineBegin = 0;              // 当前扫描线上精灵覆盖的范围 [begin, end)，没有精灵时 begin >= end
+        int _sprLineEnd = 0;
         RGB_Buffer* _spr_bufferRGB = 0;
         
         VRAM* _vram;
         Memory* _mem;
         
+        A12Listener* _a12Listener = 0;
+        bool _chrDirty = false;         // 渲染期间图案表发生了切换，需要重新绘制背景和精灵
+        bool _bkRowsStale = false;      // 本帧渲染期间切换过图案表，扫描线使用某一行tile之前需要检查这一行的图案（见 _renderNameTableRow）
+        
+        // 上次绘制背景时的背景图案表和映射（见 _renderNameTables）
+        bool _bkRedrawAll = true;
+        int _renderedBkTable = -1;
+        const uint8_t* _renderedNameTablePages[4] = {};
+        const uint8_t* _renderedRowPages[30][4] = {}; // 每一行tile绘制时的背景图案表
+        int _vramIncrement = 1;         // $2000的第2位，读写$2007后 _v 的增量
+        bool _2002ReadClearedVblank = false; // 上一次读取$2002时vblank标记为1（读取后被清除）
+        
+        // MMC2/MMC4的图案表锁存器，下标是图案表（$0000、$1000）
+        bool _chrLatchEnabled = false;
+        int _chrLatchBanks[2][2];       // 锁存器为 $FD、$FE 时的4KB bank
+        uint8_t _chrLatch[2] = {0xFE, 0xFE};
+        uint8_t _chrLatchFrameStart[2] = {0xFE, 0xFE};
+        
         bit8* _io_regs;      // I/O 寄存器, 8 x 8bit
         bit8* _control_regs; // 控制寄存器
         bit8* _mask_regs;    // PPU屏蔽寄存器
@@ -1348,6 +1738,6 @@ namespace ReNes {
         int _frame_h;
 
         uint32_t _frameCount;
-        bool _currentFrameOver;
+        bool _currentFrameOver = false;
     };
 }
@@ -3,6 +3,8 @@
 #include "cpu.hpp"
 #include "ppu.hpp"
 #include "control.hpp"
+#include "mapper.hpp"
+#include "aot.hpp"
 
 #include <functional>
 #include <stdio.h>
@@ -10,6 +12,7 @@
 #include <thread>
 #include <unistd.h>
 #include <chrono>
+#include <climits>
 #include <mutex>
 
 namespace ReNes {
@@ -28,7 +31,10 @@ namespace ReNes {
             // 等待线程退出
             stop();
             
-            _runningThread.join();
+            if (_runningThread.joinable())
+                _runningThread.join();
+            
+            _unloadRom();
             
             printf("Nes即将析构\n");
         }
@@ -38,8 +44,9 @@ namespace ReNes {
             _stoped = true;
         }
         
-        // 加载rom
-        void loadRom(const uint8_t* rom, size_t length)
+        // 加载rom，格式错误或者不支持该mapper时返回false。
+        // 卡带有电池供电的PRG RAM并且 savePath 不为空时，$6000-$7FFF 保存到 savePath 文件
+        bool loadRom(const uint8_t* rom, size_t length, const char* savePath = 0)
         {
             /*
             // iNES格式 https://wiki.nesdev.com/w/index.php/INES
@@ -72,67 +79,88 @@ namespace ReNes {
              
              */
             
-            // 解析头文件 (16字节，前3字节是"NES"字符)
-            int rom16kB_count = rom[4];
-            int vrom8kB_count = rom[5]; // 如果为0，表明主板将使用板载CHR内存
-            
-            bit8 flags6 = *(bit8*)&rom[6];
-            bit8 flags7 = *(bit8*)&rom[7];
-            
-            printf("文件长度 %zu\n", length);
-            
-            printf("[4] 16kB ROM: %d\n\
-                   [5] 8kB VROM: %d\n\
-                   [6] D0: %d D1: %d D2: %d D3: %d D4: %d D5: %d D6: %d D7: %d\n\
-                   [7] 保留0: %d %d %d %d ROM Mapper高4位: %d %d %d %d\n\
-                   [8-F] 保留8字节0: %d %d %d %d %d %d %d %d\n\
-                   [16]\n",
-                   rom[4], rom[5],
-                   flags6.get(0), flags6.get(1), flags6.get(2), flags6.get(3), flags6.get(4), flags6.get(5), flags6.get(6), flags6.get(7),
-                   flags7.get(0), flags7.get(1), flags7.get(2), flags7.get(3), flags7.get(4), flags7.get(5), flags7.get(6), flags7.get(7),
-                   rom[8], rom[9], rom[10], rom[11], rom[12], rom[13], rom[14], rom[15]);
-            
-            // 只支持 1 or 2 个16kB rom
-            RENES_ASSERT(rom16kB_count > 0 && rom16kB_count <= 2);
-            
-            // 每个bank尺寸是16kB
-            const int bankSize = 1024*16;
-            const int vromSize = 1024*8;
-            
-            const uint8_t* romBase = &rom[16];
-            const uint8_t* vromBase = romBase + bankSize*rom16kB_count;
-            
-            // 将PRG ROM载入内存（2个16kB rom）
-            for (int i=0; i<2; i++)
+            // 解析头文件 (16字节，前4字节是"NES\x1A")
+            Cartridge* cart = new Cartridge();
+            if (!cart->load(rom, length))
             {
-                // 获取rom地址
-                const uint8_t* romAddrs[2] = {romBase, romBase + bankSize}; {
-                    // 如果只有1个16kB的bank，则需要再复制一份（第二份出现在0xC000处，中断向量在每个RPG ROM最后，这里0xFFFA）
-                    if (rom16kB_count == 1)
-                        romAddrs[1] = romBase;
-                }
-                
-                _mem.loadPRGRom(romAddrs, i);
+                delete cart;
+                return false;
             }
             
-            // 将图案表数据载入VRAM
-            for (int i=0; i<vrom8kB_count; i++)
+            return _loadCartridge(cart, rom, length, savePath);
+        }
+            
+        // 从文件加载rom：文件以只读方式映射，PRG ROM、CHR ROM直接使用映射区而不复制，
+        // 多个实例加载同一个文件时共享同一份ROM数据。打开失败、格式错误或者不支持该mapper时返回false。
+        // 存档保存在ROM文件旁边，扩展名替换为 .sav
+        bool loadRomFile(const char* path)
+        {
+            Cartridge* cart = new Cartridge();
+            if (!cart->map(path))
             {
-                const uint8_t* vromAddr = vromBase + vromSize*i;
-                _ppu.loadPetternTable(vromAddr);
+                delete cart;
+                return false;
             }
+                
+            std::string savePath = path;
+            size_t dot = savePath.rfind('.');
+            if (dot != std::string::npos && savePath.find('/', dot) == std::string::npos)
+                savePath.erase(dot);
+            savePath += ".sav";
             
-            // 设置镜像模式
-            _ppu.initMirroring((PPU::MIRRORING_MODE)flags6.get(0));
+            return _loadCartridge(cart, cart->mappedData(), cart->mappedSize(), savePath.c_str());
         }
         
         
-        // 执行当前指令
+        // 在新线程上运行，按60帧每秒限速，cpu_callback 返回false或者 stop() 时退出
         void run() {
             
             _runningThread = std::thread(_runWrapper, this);
         }
         
+        // 在调用者线程上执行 count 帧，不限速，不创建线程。每帧在可见区域绘制完成、vblank开始时结束
+        // （与 ppu_displayCallback 同时），返回时 ppu()->buffer() 中是刚完成的一帧，下一帧的预渲染线才会清空它。
+        // 可以多次调用，从上次停止的位置继续。返回实际执行的帧数，发生错误、cpu_callback 返回false或者 stop() 时提前返回
+        int runFrames(int count)
+        {
+            if (!_prepare())
+                return 0;
+            
+            int frames = 0;
+            while (frames < count)
+            {
+                bool frameOver, vblank;
+                if (_step(LONG_MAX, &frameOver, &vblank) < 0)
+                    break;
+                
+                if (vblank)
+                    frames ++;
+            }
+            
+            return frames;
+        }
+        
+        // 在调用者线程上执行至少 count 个cpu周期，在第一个达到 count 的指令边界停止（指令不能被分割）。
+        // 返回实际执行的周期数，发生错误、cpu_callback 返回false或者 stop() 时提前返回
+        long runCycles(long count)
+        {
+            if (!_prepare())
+                return 0;
+            
+            long cycles = 0;
+            while (cycles < count)
+            {
+                bool frameOver, vblank;
+                int n = _step(count - cycles, &frameOver, &vblank);
+                if (n < 0)
+                    break;
+                
+                cycles += n;
+            }
+            
+            return cycles;
+        }
+        
         void setDebug(bool debug)
         {
             this->debug = debug;
@@ -146,6 +174,13 @@ namespace ReNes {
         bool debug = false;
         float cmd_interval = 0;
         
+        // 执行方式
+        enum ExecMode {
+            EXEC_MODE_INSTRUCTION,  // 逐条执行指令，每条指令之后PPU追上CPU，cpu_callback 每条指令调用一次
+            EXEC_MODE_BLOCK,        // 按基本块执行指令，PPU只在块结束和访问I/O时追上CPU，cpu_callback 每个块调用一次
+        };
+        ExecMode execMode = EXEC_MODE_INSTRUCTION; // 在第一次运行之前设置
+        
         
         inline CPU* cpu() { return &_cpu; }
         
@@ -155,6 +190,9 @@ namespace ReNes {
 
         inline Control* ctr() { return &_ctr; }
         
+        // PRG ROM数据的CRC32
+        inline uint32_t prgCrc() const { return _prgCrc; }
+        
         inline long cpuCycleTime() const { return _cpuCycleTime; }
         
         inline long renderTime() const { return _renderTime; }
@@ -162,26 +200,145 @@ namespace ReNes {
         // 每帧花费时间: 纳秒
         inline long perFrameTime() const { return _perFrameTime; }
         
+        // 上一帧中跳过的轮询、计数循环的周期数（EXEC_MODE_BLOCK）
+        inline long skippedCyclesPerFrame() const { return _skippedCyclesPerFrame; }
+        
         inline bool isRunning() const {return _isRunning;};
         
-        // 回调函数
-        std::function<bool(CPU*)> cpu_callback;
-        std::function<bool(PPU*)> ppu_displayCallback;
-        std::function<void()> willRunning;
+        // 回调函数，都可以不设置
+        std::function<bool(CPU*)> cpu_callback;         // 调试器使用，设置后每条指令（或每个块）都会调用
+        std::function<bool(PPU*)> ppu_displayCallback;  // vblank时调用
+        std::function<void()> willRunning;              // 开始运行之前调用
         
     private:
         
+        // 显示器制式数据: NTSC
+        const static int FrameW = 341;
+        const static int FrameH = 262;
+        const static int FPS = 60; // 包含vblank时间
+        
+        const static uint32_t NumScanpointPerCpuCycle = 3;     // 每个cpu周期能绘制的点数(每个像素需要1/3 CPU周期，由CPU和PPU的频率算得，见ppu.hpp)
+        
         static
         void _runWrapper(Nes* nes) {
             
             nes->_run();
         }
         
-        void _run() {
+        // 由解析好的卡带完成加载，cart 由Nes接管
+        bool _loadCartridge(Cartridge* cart, const uint8_t* rom, size_t length, const char* savePath)
+        {
+            bit8 flags6 = *(bit8*)&rom[6];
+            bit8 flags7 = *(bit8*)&rom[7];
             
-            _isRunning = true;
+            printf("文件长度 %zu\n", length);
+            
+            printf("[4] 16kB ROM: %d\n\
+                   [5] 8kB VROM: %d\n\
+                   [6] D0: %d D1: %d D2: %d D3: %d D4: %d D5: %d D6: %d D7: %d\n\
+                   [7] 保留0: %d %d %d %d ROM Mapper高4位: %d %d %d %d\n\
+                   [8-F] 保留8字节0: %d %d %d %d %d %d %d %d\n\
+                   [16]\n",
+                   rom[4], rom[5],
+                   flags6.get(0), flags6.get(1), flags6.get(2), flags6.get(3), flags6.get(4), flags6.get(5), flags6.get(6), flags6.get(7),
+                   flags7.get(0), flags7.get(1), flags7.get(2), flags7.get(3), flags7.get(4), flags7.get(5), flags7.get(6), flags7.get(7),
+                   rom[8], rom[9], rom[10], rom[11], rom[12], rom[13], rom[14], rom[15]);
+            
+            printf("Mapper: %d\n", cart->mapperNumber);
+            
+            Mapper* mapper = createMapper(cart->mapperNumber, cart, &_cpu, &_mem, &_ppu);
+            if (!mapper)
+            {
+                LOGE("不支持的Mapper %d\n", cart->mapperNumber);
+                delete cart;
+                return false;
+            }
+            
+            _unloadRom();
+            _cart = cart;
+            _mapper = mapper;
+            
+            // PRG ROM、图案表数据由mapper按bank映射（CHR ROM为空时使用CHR RAM）
+            _mem.setPrgRom(_cart->prg, _cart->prgSize);
+            _ppu.setChrData(_cart->chr, _cart->chrSize);
+            
+            // 设置镜像模式
+            _ppu.initMirroring(_cart->mirroring);
+            
+            // 电池供电的PRG RAM映射到存档文件，失败时使用内部内存（不保存）
+            if (_cart->battery && savePath)
+            {
+                _batteryRam = new BatteryRam();
+                if (_batteryRam->open(savePath))
+                {
+                    printf("存档 %s\n", savePath);
+                    _mem.setPrgRam(_batteryRam->data());
+                }
+                else
+                {
+                    delete _batteryRam;
+                    _batteryRam = 0;
+                }
+            }
+            
+            // trainer载入到 $7000-$71FF，必须在映射PRG RAM之后写入当前映射的内存。
+            // 和拷贝机上电时的行为一致，每次加载都覆盖存档中这512字节（这一段是trainer的代码，不是存档数据）
+            if (_cart->trainer)
+                memcpy(_mem.prgRam() + 0x1000, _cart->trainer, Cartridge::TRAINER_SIZE);
+            
+            _mapper->reset();
+            
+            if (_mapper->hasRegisters())
+                _mem.setRomWriteHandler(_mapper->registerWriteHandler(), _mapper);
+            else
+                _mem.clearRomWriteHandler();
+            
+            // 使用预编译的代码（见 aot.hpp），PRG ROM可以切换时不使用
+            _prgCrc = crc32(_cart->prg, _cart->prgSize);
+            const AotProgram* program = _mem.prgSwitchable() ? 0 : AotRegistry::find(_prgCrc);
+            if (program)
+            {
+                printf("使用预编译代码 %s\n", program->name);
+                _cpu.setPrecompiledBlocks(program->blocks, program->count, _mem.prgVersion());
+            }
+            
+            return true;
+        }
+        
+        void _unloadRom()
+        {
+            // 先恢复页表，再写回并关闭存档
+            if (_batteryRam)
+            {
+                _mem.setPrgRam(0);
+                delete _batteryRam;
+                _batteryRam = 0;
+            }
+            
+            if (_mapper)
+            {
+                _mem.clearRomWriteHandler();
+                delete _mapper;
+                _mapper = 0;
+            }
+            
+            if (_cart)
+            {
+                delete _cart;
+                _cart = 0;
+            }
+        }
+        
+        // 第一次运行之前初始化，返回能否继续运行
+        bool _prepare()
+        {
             _stoped = false;
             
+            if (_prepared)
+                return !_cpu.error;
+            
+            _prepared = true;
+            
             // 初始化cpu
             _cpu.init(&_mem);
             _ppu.init(&_mem);
@@ -189,108 +346,136 @@ namespace ReNes {
             if (willRunning)
                 willRunning();
             
-            //-----------------------------------
             // 控制器处理
-            int dstWrite4016 = 0;
-            uint16_t dstAddr4016tmp = 0;
-            uint16_t dstAddr4016 = 0;
+            _ctr.init(&_mem);
             
-            _mem.addWritingObserver(0x4016, [this, &dstWrite4016, &dstAddr4016tmp,  &dstAddr4016](uint16_t addr, uint8_t value){
+            _ppu.setSystemInfo(FrameW, FrameH);
                 
-                // 写0x4016 2次，以设置从0x4016读取的硬件信息
-                std::function<void(int&,uint16_t&, uint16_t&)> dstAddrWriting = [value](int& dstWrite, uint16_t& dstAddrTmp, uint16_t& dstAddr){
+            if (execMode == EXEC_MODE_BLOCK)
+            {
+                // 块内访问I/O之前，让PPU追上当前的CPU周期（块的长度保证这里不会跨过vblank等事件）
+                _mem.setIOAccessObserver([this](){
                     
-                    int writeBitIndex = (dstWrite+1) % 2;
+                    int cycles = _cpu.takeUnsyncedCycles();
+                    if (cycles > 0)
+                        _ppu.drawScanline(nullptr, cycles * NumScanpointPerCpuCycle);
+                });
+                
+                // 轮询$2002的循环，可以跳到PPU状态发生变化之前
+                _cpu.ioStableCycles = [this](uint16_t addr){
                     
-                    dstAddrTmp &= (0xFF << dstWrite*8); // 清理相反的高/低位
-                    dstAddrTmp |= (value << writeBitIndex*8); // 设置对应位
+                    if (addr != 0x2002)
+                        return -1;
                     
-                    dstWrite = (dstWrite+1) % 2;
+                    int cycles = _cpu.takeUnsyncedCycles();
+                    if (cycles > 0)
+                        _ppu.drawScanline(nullptr, cycles * NumScanpointPerCpuCycle);
                     
-                    if (dstWrite == 0)
-                        dstAddr = dstAddrTmp;
+                    // 已经发生变化时（上一次读取清除了vblank标记）不能跳过
+                    int pixels = _ppu.pixelsUntilStatusChange();
+                    return pixels > 0 ? (int)((pixels - 1) / NumScanpointPerCpuCycle) : -1;
                 };
+            }
                 
-                dstAddrWriting(dstWrite4016, dstAddr4016tmp, dstAddr4016);
+            _skippedCyclesCount = _cpu.skippedCycles;
                 
-                // 每次重新请求控制器的时候，重置按键
-                if (dstWrite4016 == 0 && dstAddr4016 == 0x100)
-                {
-                    _ctr.reset();
-                }
-            });
-            
-            _mem.addReadingObserver(0x4016, [this, &dstWrite4016, &dstAddr4016](uint16_t addr, uint8_t* value, bool* valid){
+            return true;
+        }
                 
-                if (dstAddr4016 == 0x100)
-                {
-                    *value = _ctr.nextKeyStatue();
-                    
-                    // dstWrite4016 = 0; ?
-                }
-            });
-            //-----------------------------------
+        // 执行一条指令（EXEC_MODE_BLOCK 时执行一个块，最多 cycleLimit 个周期），PPU追上CPU，处理vblank。
+        // frameOver 表示最后一条扫描线完成，vblank 表示可见区域绘制完成。返回执行的周期数，需要停止的时候返回-1
+        int _step(long cycleLimit, bool* frameOver, bool* vblank)
+        {
+            *frameOver = false;
+            *vblank = false;
+            
+            if (_stoped)
+                return -1;
+            
+            // 执行指令
+            int cycles;
+            int drawCycles;
+            if (execMode == EXEC_MODE_BLOCK)
+            {
+                // 块在到达下一个PPU事件的周期处结束，与逐条执行时事件发生在同一条指令之后
+                long budget = (_ppu.pixelsUntilNextEvent() + NumScanpointPerCpuCycle - 1) / NumScanpointPerCpuCycle;
+                cycles = _cpu.execBlock((int)NES_MIN(budget, cycleLimit));
+                drawCycles = _cpu.takeUnsyncedCycles();
+            }
+            else
+            {
+                cycles = _cpu.exec();
+                drawCycles = cycles;
+            }
+            
+            // 发生错误，退出
+            if (_cpu.error)
+                return -1;
+            
+            // 当前CPU指令周期内，可以绘制多少个点
+            _cpuCyclesCountForFrame += cycles;
             
-            // CPU周期线程 (不用创建线程)
-//            std::thread cpu_thread = std::thread([this](){
+            // 满足一次扫描线所经过的CPU周期，执行下面代码，模拟这段时间内，PPU发生的工作
+            bool vblankEvent;
+            _ppu.drawScanline(&vblankEvent, drawCycles * NumScanpointPerCpuCycle);
+            
+            if (vblankEvent)
             {
+                *vblank = true;
                 
-                std::chrono::steady_clock::time_point firstTime;
+                // vblank发生的时候，需要设置NMI中断
+                _cpu.interrupts(CPU::InterruptTypeNMI);
+                
+                // 当前可见区域已经绘制完成
+                // 通知PPU回调: 刷新视图(异步) 刷新率由UI决定
+                if (ppu_displayCallback)
+                    ppu_displayCallback(&_ppu);
+            }
+                    
+            // 最后一条扫描线完成(第261条扫描线，scanline+1 == 262)
+            if (_ppu.currentFrameOver())
+            {
+                *frameOver = true;
                 
-                // 显示器制式数据: NTSC
-                const int frame_w = 341;
-                const int frame_h = 262;
-                const int FPS = 60; // 包含vblank时间
+                _cpuCyclesPerFrame = _cpuCyclesCountForFrame;
+                _cpuCyclesCountForFrame = 0;
                 
-                _ppu.setSystemInfo(frame_w, frame_h);
+                _skippedCyclesPerFrame = _cpu.skippedCycles - _skippedCyclesCount;
+                _skippedCyclesCount = _cpu.skippedCycles;
+            }
+            
+            if (cpu_callback && !cpu_callback(&_cpu))
+                _stoped = true;
+            
+            return cycles;
+        }
+        
+        void _run() {
+            
+            _isRunning = true;
+            
+            if (_prepare())
+            {
+                std::chrono::steady_clock::time_point firstTime;
                 
-                uint32_t cpuCyclesCountForFrame = 0;            // 每一帧内：cpu周期数计数器
-                const uint32_t NumScanpointPerCpuCycle = 3;     // 每个cpu周期能绘制的点数(每个像素需要1/3 CPU周期，由CPU和PPU的频率算得，见ppu.hpp)
                 const uint32_t TimePerFrame = 1.0 / FPS * 1e9; // 每帧需要的时间(纳秒)
                 
                 // 主循环
-                bool exitFromCPU;
                 firstTime = std::chrono::steady_clock::now();
                 
-                do {
-                    
-                    // 执行指令
-                    int cycles = _cpu.exec();
-                    
-                    // 发生错误，退出
-                    if (_cpu.error)
+                while (true)
+                {
+                    bool frameOver, vblank;
+                    if (_step(LONG_MAX, &frameOver, &vblank) < 0)
                         break;
                     
-                    // 当前CPU指令周期内，可以绘制多少个点
-                    cpuCyclesCountForFrame += cycles;
-
-                    // 满足一次扫描线所经过的CPU周期，执行下面代码，模拟这段时间内，PPU发生的工作
-                    bool vblankEvent;
-                    _ppu.drawScanline(&vblankEvent, cycles * NumScanpointPerCpuCycle);
-                    
-                    if (vblankEvent)
-                    {
-                        // vblank发生的时候，需要设置NMI中断
-                        _cpu.interrupts(CPU::InterruptTypeNMI);
-                        
-                        // 当前可见区域已经绘制完成
-                        // 通知PPU回调: 刷新视图(异步) 刷新率由UI决定
-                        ppu_displayCallback(&_ppu);
-                    }
-                    
-                    exitFromCPU = !cpu_callback(&_cpu);
-                    
-                    // 最后一条扫描线完成(第261条扫描线，scanline+1 == 262)
-                    if (_ppu.currentFrameOver())
+                    if (frameOver)
                     {
                         // 模拟等待，模拟每一帧完整时间花费
                         auto now = std::chrono::steady_clock::now();
                         auto currentFrameTime = (now - firstTime).count(); // 当前帧完结时所需纳秒时间
                         _perFrameTime = currentFrameTime;
-                        _cpuCycleTime  = currentFrameTime / cpuCyclesCountForFrame;
-                        
-                        // 计数器重置
-                        cpuCyclesCountForFrame  = 0;
+                        _cpuCycleTime  = currentFrameTime / _cpuCyclesPerFrame;
                         
                         // 检查是否需要等待
                         int needDelay = (int)(TimePerFrame - currentFrameTime); // 需要等待的纳秒数
@@ -312,15 +497,9 @@ namespace ReNes {
                             firstTime = now;
                         }
                     }
-                    
-                }while(!exitFromCPU && !_stoped);
-                
-//            });
+                }
             }
             
-            // 等待线程结束
-//            cpu_thread.join();
-            
             if (_cpu.error)
             {
                 log("模拟器因故障退出!\n");
@@ -334,6 +513,7 @@ namespace ReNes {
         }
         
         bool _isRunning = false;
+        bool _prepared = false;
         
         // 硬件
         CPU _cpu;
@@ -344,8 +524,19 @@ namespace ReNes {
         long _cpuCycleTime;
         long _renderTime;
         long _perFrameTime;
+        long _skippedCyclesPerFrame = 0;
+        
+        uint32_t _cpuCyclesCountForFrame = 0;   // 每一帧内：cpu周期数计数器
+        uint32_t _cpuCyclesPerFrame = 0;        // 上一帧的cpu周期数
+        long _skippedCyclesCount = 0;           // 当前帧开始时跳过的周期数
+        
+        Cartridge* _cart = 0;
+        BatteryRam* _batteryRam = 0;
+        Mapper* _mapper = 0;
+        
+        uint32_t _prgCrc = 0;
         
-        bool _stoped;
+        bool _stoped = false;
         
         std::thread _runningThread;
     };
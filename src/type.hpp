@@ -12,33 +12,54 @@ namespace ReNes {
 #define RENES_DEBUG
 #else
 #define RENES_ASSERT(...)
+#endif
+    
+    // 强制内联，用于模板特化后需要展开成直线代码的函数
+#if defined(__GNUC__) || defined(__clang__)
+#define RENES_FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define RENES_FORCE_INLINE inline
 #endif
     
     //--------------------------------------
     // log打印
     
-    static char g_buffer[1024];
+    // 状态放在inline函数的static变量中，所有翻译单元（包括预编译的 aot_*.cpp）共享同一份
+    inline char* g_buffer()
+    {
+        static char buffer[1024];
+        return buffer;
+    }
     
-    static std::function<void(const char*)> g_callback;
-    static bool g_logEnabled = false;
+    inline std::function<void(const char*)>& g_callback()
+    {
+        static std::function<void(const char*)> callback;
+        return callback;
+    }
     
-    bool _log(const char* format, ...)
+    inline bool& g_logEnabled()
     {
-        if (!g_logEnabled)
+        static bool enabled = false;
+        return enabled;
+    }
+    
+    inline bool _log(const char* format, ...)
+    {
+        if (!g_logEnabled())
             return true;
         
         va_list args;
         va_start(args, format);
-        vsprintf(g_buffer, format, args);
+        vsprintf(g_buffer(), format, args);
         va_end(args);
         
-        if (g_callback != 0)
+        if (g_callback() != 0)
         {
-            g_callback(g_buffer);
+            g_callback()(g_buffer());
         }
         else
         {
-            printf("%s", g_buffer);
+            printf("%s", g_buffer());
         }
         
         return true;
@@ -50,14 +71,14 @@ namespace ReNes {
    #define log(...)
 #endif
     
-    void setLogCallback(std::function<void(const char*)> callback)
+    inline void setLogCallback(std::function<void(const char*)> callback)
     {
-        g_callback = callback;
+        g_callback() = callback;
     }
     
-    void setLogEnabled(bool enabled)
+    inline void setLogEnabled(bool enabled)
     {
-        g_logEnabled = enabled;
+        g_logEnabled() = enabled;
     }
     
     //--------------------------------------
@@ -128,6 +149,19 @@ namespace ReNes {
         return false;
     }
     
+    // CRC32 (IEEE 802.3)，用于识别ROM
+    inline uint32_t crc32(const uint8_t* data, size_t length)
+    {
+        uint32_t crc = 0xFFFFFFFF;
+        for (size_t i=0; i<length; i++)
+        {
+            crc ^= data[i];
+            for (int k=0; k<8; k++)
+                crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+        return ~crc;
+    }
+
 #define RENES_ARRAY_FIND(s, v) array_find(s, sizeof(s)/sizeof(*s), v)
 //#define RENES_VECTOR_FIND(s, v) (std::find(s.begin(), s.end(), v) != s.end())
 #define RENES_SET_FIND(s, v) (s.find(v) != s.end())
@@ -27,9 +27,32 @@ namespace ReNes {
         
         enum MIRRORING_MODE{
             MIRRORING_MODE_HORIZONTAL,
-            MIRRORING_MODE_VERTICAL
+            MIRRORING_MODE_VERTICAL,
+            MIRRORING_MODE_ONE_SCREEN_LOWER,    // 单屏，都使用名称表0
+            MIRRORING_MODE_ONE_SCREEN_UPPER,    // 单屏，都使用名称表1
+            MIRRORING_MODE_FOUR_SCREEN,         // 卡带提供额外的VRAM，4个名称表
         };
         
+        // $0000-$3FFF 按1KB分页，共16页：图案表 $0000-$1FFF 占前8页，
+        // 名称表 $2000-$2FFF 占4页，$3000-$3FFF 是名称表的镜像（其中 $3F00 之后是调色板）
+        const static int PAGE_SIZE = 0x0400;
+        const static int PAGE_COUNT = 16;
+        
+        const static int CHR_PAGE_SIZE = PAGE_SIZE;
+        const static int CHR_PAGE_COUNT = 8;
+        
+        const static int NAME_TABLE_PAGE = 8;
+        const static int NAME_TABLE_COUNT = 4;
+        const static int NAME_TABLE_TILE_COUNT = 32 * 30;  // 之后的64字节是属性表
+        
+        // 图案表 $0000-$1FFF 共512个tile，每个tile解码成8x8个像素
+        const static int TILE_COUNT = 512;
+        const static int TILE_PIXELS = 64;
+        
+        // 调色板 $3F00-$3F1F，在 $3F20-$3FFF 中每32字节镜像
+        const static int PALETTE_OFFSET = 0x3F00;
+        const static int PALETTE_MASK = 0x1F;
+        
         const static int DEFUALT_SIZE = 0x4000;
         
         VRAM()
@@ -37,39 +60,64 @@ namespace ReNes {
             // 申请内存 16KB
             _data = (uint8_t*)malloc(DEFUALT_SIZE);
             memset(_data, 0, DEFUALT_SIZE);
+            
+            // 解码后的tile，每个tile有正常和水平翻转两份
+            _tiles = (uint8_t*)malloc(TILE_COUNT * TILE_PIXELS * 2);
+            memset(_tileValid, 0, sizeof(_tileValid));
+            
+            clearBackgroundDirty();
+            
+            // 默认使用8KB的CHR RAM
+            setChrData(0, 0);
+            
+            initMirroring(MIRRORING_MODE_HORIZONTAL);
         }
         
         ~VRAM()
         {
             if (_data)
                 free(_data);
+            
+            if (_tiles)
+                free(_tiles);
         }
         
+        // 可以在运行时由mapper重新设置，只修改名称表的页表，O(1)
         void initMirroring(MIRRORING_MODE mode)
         {
-            // 设置镜像
-            addMirroring(&_data[0x2000], 0x3000, 0x3EFF); // 名称表镜像
-            addMirroring(&_data[0x3F00], 0x3F20, 0x3FFF); // 调色板镜像
+            RENES_ASSERT(mode >= MIRRORING_MODE_HORIZONTAL && mode <= MIRRORING_MODE_FOUR_SCREEN);
+            
+            // 每种镜像模式下，4个名称表对应的实际名称表
+            const static int layouts[][NAME_TABLE_COUNT] = {
+                {0, 0, 1, 1},   // 水平镜像，竖直排列
+                {0, 1, 0, 1},   // 垂直镜像，水平排列
+                {0, 0, 0, 0},   // 单屏，都使用名称表0
+                {1, 1, 1, 1},   // 单屏，都使用名称表1
+                {0, 1, 2, 3},   // 4屏
+            };
+            const int* layout = layouts[mode];
+            
+            // $2000-$2FFF，以及它的镜像 $3000-$3EFF
+            for (int i=0; i<NAME_TABLE_COUNT; i++)
+            {
+                uint8_t* page = &_data[0x2000 + layout[i] * PAGE_SIZE];
+                _pages[NAME_TABLE_PAGE + i] = page;
+                _pages[NAME_TABLE_PAGE + NAME_TABLE_COUNT + i] = page;
+            }
             
-            // 名称表镜像
-            switch (mode) {
-                case MIRRORING_MODE_HORIZONTAL:
-                    // 水平镜像，竖直排列
-                    // 0, 0
-                    // 1, 1
-                    addMirroring(&_data[0x2000], 0x2400, 0x27FF);
-                    addMirroring(&_data[0x2800], 0x2C00, 0x2FFF);
-                    break;
-                case MIRRORING_MODE_VERTICAL:
-                    // 垂直镜像，水平排列
-                    // 0, 1
-                    // 0, 1
-                    addMirroring(&_data[0x2000], 0x2800, 0x2BFF);
-                    addMirroring(&_data[0x2400], 0x2C00, 0x2FFF);
-                    break;
-                default:
-                    assert(!"error");
-                    break;
+            // 互为镜像的名称表：从下一个开始找到的第一个相同的名称表，没有时是自身
+            for (int i=0; i<NAME_TABLE_COUNT; i++)
+            {
+                _nameTableMirrorings[i] = i;
+                for (int k=1; k<NAME_TABLE_COUNT; k++)
+                {
+                    int j = (i + k) % NAME_TABLE_COUNT;
+                    if (layout[j] == layout[i])
+                    {
+                        _nameTableMirrorings[i] = j;
+                        break;
+                    }
+                }
             }
         }
         
@@ -79,6 +127,13 @@ namespace ReNes {
             return _data;
         }
         
+        // 按当前页表导出 $0000-$3FFF（包括切换的CHR bank、名称表镜像），dst 至少 DEFUALT_SIZE 字节
+        void dump(uint8_t* dst) const
+        {
+            for (int i=0; i<DEFUALT_SIZE; i++)
+                dst[i] = read8bitData(i);
+        }
+        
         // 读取数据
         inline
         uint8_t read8bitData(uint16_t addr) const
@@ -104,155 +159,285 @@ namespace ReNes {
         inline
         void write8bitData(uint16_t addr, uint8_t value)
         {
+            // CHR ROM只读
+            if ((addr & 0x3FFF) < 0x2000)
+            {
+                if (!_chrWritable)
+                    return;
+                
+                if (*_getRealAddr(addr) != value)
+                    _invalidateChrWrite(addr & 0x1FFF);
+            }
+            else if ((addr & 0x3FFF) < PALETTE_OFFSET)
+            {
+                if (*_getRealAddr(addr) != value)
+                    _markNameTableWrite(addr);
+            }
+            
+            // 调色板每项只有6bit，超出系统调色板的值会越界
+            if ((addr & 0x3FFF) >= PALETTE_OFFSET)
+                value &= 0x3F;
+            
             *_getRealAddr(addr) = value;
         }
         
-        // 加载图案表
-        void loadPetternTable(const uint8_t* addr)
+        // 设置图案表数据（CHR ROM，只读，不复制），data 为0时使用VRAM中8KB的CHR RAM
+        void setChrData(const uint8_t* data, size_t size)
         {
-            // 8KB
-            memcpy(_getRealAddr(0x0000), addr, 0x2000);
+            if (data)
+            {
+                _chr = const_cast<uint8_t*>(data);
+                _chrPageCount = (int)(size / CHR_PAGE_SIZE);
+                _chrWritable = false;
+            }
+            else
+            {
+                _chr = _data;
+                _chrPageCount = 0x2000 / CHR_PAGE_SIZE;
+                _chrWritable = true;
+            }
+            
+            for (int i=0; i<CHR_PAGE_COUNT; i++)
+                mapChrPage(i, i);
+        }
+        
+        // 将第 bank 个1KB的图案表数据映射到第 slot 页（$0000 + slot*1KB），只修改页表，不复制数据
+        // 返回映射是否发生了变化
+        inline
+        bool mapChrPage(int slot, int bank)
+        {
+            RENES_ASSERT(slot >= 0 && slot < CHR_PAGE_COUNT);
+            
+            bank %= _chrPageCount;
+            if (bank < 0)
+                bank += _chrPageCount;
+            
+            uint8_t* page = _chr + bank * CHR_PAGE_SIZE;
+            if (_pages[slot] == page)
+                return false;
+            
+            _pages[slot] = page;
+            
+            // 这一页的tile需要重新解码
+            memset(&_tileValid[slot * (CHR_PAGE_SIZE / 16)], 0, CHR_PAGE_SIZE / 16);
+            return true;
+        }
+        
+        inline
+        int chrPageCount() const
+        {
+            return _chrPageCount;
         }
 
         bool error = false;
         
         ////////////////////////////////////////////
         
-        // 图案表地址
-        // 图案表：256*16(4KB)的空间 index in [2]
-        const uint8_t* petternTableAddress(int index) const
+        // 图案表中tile的地址
+        // 图案表：256*16(4KB)的空间 index in [2]，每个tile 16字节，8x16精灵的两个tile在同一页中
+        inline
+        const uint8_t* tileAddress(int index, int tileIndex) const
         {
             RENES_ASSERT(index == 0 || index == 1);
-            return const_cast<VRAM*>(this)->_getRealAddr(0x1000 * index);
-            // return &_data[0x1000 * index]; // 第3bit决定精灵图案表地址 0x0000或0x1000
+            return _pages[(index << 2) | (tileIndex >> 6)] + (tileIndex & 0x3F) * 16;
+        }
+        
+        // 图案表中tile解码后的像素：8x8个2bit调色板下标，每个像素1字节，按行从左到右排列；
+        // flipH 为true时是水平翻转后的像素。只在tile的数据变化（切换bank、写入CHR RAM）之后第一次使用时重新解码
+        inline
+        const uint8_t* decodedTile(int index, int tileIndex, bool flipH = false) const
+        {
+            RENES_ASSERT(index == 0 || index == 1);
+            
+            int tile = (index << 8) | tileIndex;
+            if (!_tileValid[tile])
+                const_cast<VRAM*>(this)->_decodeTile(tile);
+            
+            return _tiles + (tile * 2 + flipH) * TILE_PIXELS;
         }
         
         // 背景调色板地址
         const uint8_t* bkPaletteAddress() const
         {
-            return const_cast<VRAM*>(this)->_getRealAddr(0x3F00);
-            // return &_data[0x3F00];
+            return &_data[PALETTE_OFFSET];
         }
         
         // 精灵调色板地址
         const uint8_t* sprPaletteAddress() const
         {
-            return const_cast<VRAM*>(this)->_getRealAddr(0x3F10);
-            // return &_data[0x3F10];
+            return &_data[PALETTE_OFFSET + 0x10];
         }
         
         // 名称表地址
+        inline
         const uint8_t* nameTableAddress(int index) const
         {
-            return const_cast<VRAM*>(this)->_getRealAddr(0x2000 + index*0x0400);
-            //  return &_data[0x2000 + index*0x0400];
+            return _pages[NAME_TABLE_PAGE + index];
         }
         
         // 属性表地址
+        inline
         const uint8_t* attributeTableAddress(int index) const
         {
-            return const_cast<VRAM*>(this)->_getRealAddr(0x23C0 + index*0x0400);
-            // return &_data[0x23C0 + index*0x0400];
+            return _pages[NAME_TABLE_PAGE + index] + 0x3C0;
+        }
+        
+        // 第 index 页映射的数据
+        inline
+        const uint8_t* page(int index) const
+        {
+            return _pages[index];
+        }
+        
+        // 名称表中有没有需要重新绘制的tile（写入了名称表、属性表）
+        inline
+        bool nameTableDirty(int index) const
+        {
+            return _nameTableAnyDirty[index];
+        }
+        
+        // 名称表中每个tile是否需要重新绘制，32x30
+        inline
+        const bool* nameTableDirtyTiles(int index) const
+        {
+            return _nameTableDirty[index];
+        }
+        
+        // 图案表中有没有写入过的tile
+        inline
+        bool patternDirty(int index) const
+        {
+            return _patternAnyDirty[index];
+        }
+        
+        // 图案表中的tile是否写入过
+        inline
+        bool patternTileDirty(int index, int tileIndex) const
+        {
+            return _patternDirty[(index << 8) | tileIndex];
+        }
+        
+        // 背景绘制之后清除写入标记（见 PPU::_renderNameTables）
+        void clearBackgroundDirty()
+        {
+            memset(_nameTableDirty, 0, sizeof(_nameTableDirty));
+            memset(_nameTableAnyDirty, 0, sizeof(_nameTableAnyDirty));
+            memset(_patternDirty, 0, sizeof(_patternDirty));
+            memset(_patternAnyDirty, 0, sizeof(_patternAnyDirty));
         }
         
         // 得到名称表镜像index，支持检测互为镜像index
-        const int nameTableMirroring(int index) const
+        inline
+        int nameTableMirroring(int index) const
         {
-            // 通过判断内存地址来比较是否是镜像
-            const uint8_t* addr = nameTableAddress(index);
-            int i = index;
-            do
-            {
-                i = (i + 1) % 4;
-                if (nameTableAddress(i) == addr)
-                {
-                    return i;
-                }
-            }while (i != index);
-            return index;
+            return _nameTableMirrorings[index];
         }
         
     private:
         
-        struct Mirroring {
+        // 得到实际内存地址：调色板按掩码镜像，其余按1KB页表
+        inline
+        uint8_t* _getRealAddr(uint16_t addr)
+        {
+            addr &= 0x3FFF;
             
-            uint8_t  *data;
-            uint16_t start;
-            uint16_t end;
+            if (addr >= PALETTE_OFFSET)
+                return &_data[PALETTE_OFFSET + (addr & PALETTE_MASK)];
+
+            return _pages[addr / PAGE_SIZE] + (addr % PAGE_SIZE);
+        }
+        
+        // 把tile的两个位平面（各8字节）解码成每像素1字节，同时生成水平翻转的版本
+        void _decodeTile(int tile)
+        {
+            const uint8_t* src = _pages[tile / 64] + (tile % 64) * 16;
+            uint8_t* dst = _tiles + tile * 2 * TILE_PIXELS;
+            uint8_t* flipped = dst + TILE_PIXELS;
             
-            Mirroring(uint8_t *data, uint16_t start, uint16_t end)
+            for (int y=0; y<8; y++)
             {
-                this->data = data;
-                this->start = start;
-                this->end = end;
+                int low = src[y];
+                int high = src[y + 8];
+                
+                // 最高位是左边第一个像素
+                for (int x=0; x<8; x++)
+                {
+                    uint8_t pixel = ((low >> (7 - x)) & 1) | (((high >> (7 - x)) & 1) << 1);
+                    dst[y * 8 + x] = pixel;
+                    flipped[y * 8 + 7 - x] = pixel;
+                }
             }
             
-            inline bool hit(uint16_t addr) const
-            {
-                return addr >= start && addr <= end;
-            }
-            inline uint8_t* address(uint16_t addr)
-            {
-                RENES_ASSERT(hit(addr));
-                return &data[addr - start];
-            }
-        };
-        std::vector<Mirroring> _mirrorings;
+            _tileValid[tile] = true;
+        }
         
-        void addMirroring(uint8_t *data, uint16_t start, uint16_t end)
+        // 写入CHR RAM，所有映射到这一页的tile都需要重新解码，使用了它们的背景tile需要重新绘制
+        inline
+        void _invalidateChrWrite(uint16_t addr)
         {
-            // 禁止镜像区域交叉
-            for (auto& mirr : _mirrorings)
+            const uint8_t* page = _pages[addr / PAGE_SIZE];
+            int tile = (addr % PAGE_SIZE) / 16;
+            
+            for (int slot=0; slot<CHR_PAGE_COUNT; slot++)
             {
-                if (mirr.hit(start) || mirr.hit(end) || mirr.hit(data-_data))
+                if (_pages[slot] == page)
                 {
-                    RENES_ASSERT(!"无效的镜像设置");
-                    return;
+                    _tileValid[slot * (CHR_PAGE_SIZE / 16) + tile] = false;
+                    _patternDirty[slot * (CHR_PAGE_SIZE / 16) + tile] = true;
+                    _patternAnyDirty[slot / 4] = true;
                 }
             }
-            
-            _mirrorings.push_back(Mirroring(data, start, end));
         }
         
-        // 得到实际内存地址
+        // 写入名称表、属性表，所有映射到这一页的名称表中受影响的tile需要重新绘制
         inline
-        uint8_t* _getRealAddr(uint16_t addr)
+        void _markNameTableWrite(uint16_t addr)
         {
-//#ifdef DEBUG
-//            // 处理调色板镜像
-//            uint16_t testAddr = addr;
-//            if (addr >= 0x3F20 && addr <= 0x3FFF)
-//            {
-//                testAddr = 0x3F00 + ((addr-0x3F20) % 0x20);
-//            }
-//            else if (addr >= 0x3000 && addr <= 0x3EFF)
-//            {
-//                testAddr = 0x2000 + (addr - 0x3000);
-//            }
-//            else if (addr > 0x3FFF)
-//            {
-//                testAddr = addr % 0x4000;
-////                printf("fix %x -> %x\n", addr, fixedAddr);
-//            }
-//#endif
-            // 遍历镜像设置
-            for (auto& mirr : _mirrorings)
+            const uint8_t* page = _pages[(addr & 0x3FFF) / PAGE_SIZE];
+            int offset = addr % PAGE_SIZE;
+            
+            for (int i=0; i<NAME_TABLE_COUNT; i++)
             {
-                if (mirr.hit(addr))
+                if (_pages[NAME_TABLE_PAGE + i] != page)
+                    continue;
+                
+                _nameTableAnyDirty[i] = true;
+                
+                if (offset < NAME_TABLE_TILE_COUNT)
                 {
-                    uint8_t *retAddr = mirr.address(addr);
-//#ifdef DEBUG
-//                    // 检查默认镜像设置问题
-//                    RENES_ASSERT(&_data[addr] == retAddr);
-//#endif
-                    return retAddr;
+                    _nameTableDirty[i][offset] = true;
+                }
+                else
+                {
+                    // 属性表的一个字节影响4x4个tile
+                    int attr = offset - NAME_TABLE_TILE_COUNT;
+                    int tile_x = attr % 8 * 4;
+                    int tile_y = attr / 8 * 4;
+                    for (int y=tile_y; y<tile_y+4 && y<30; y++)
+                    {
+                        for (int x=tile_x; x<tile_x+4; x++)
+                            _nameTableDirty[i][y*32 + x] = true;
+                    }
                 }
             }
-
-            return &_data[addr % DEFUALT_SIZE];
         }
         
         uint8_t* _data = 0;
-        bool _updateBkColor = false;
+        
+        uint8_t* _chr = 0;                      // 图案表数据（CHR ROM 或者 CHR RAM）
+        int _chrPageCount = 0;
+        bool _chrWritable = false;
+        
+        uint8_t* _pages[PAGE_COUNT] = {};       // 每页映射的数据，前 CHR_PAGE_COUNT 页是图案表
+        int _nameTableMirrorings[NAME_TABLE_COUNT];
+        
+        uint8_t* _tiles = 0;                    // 当前映射的8页图案表解码后的tile（512个，约64KB），切换bank时按页失效
+        bool _tileValid[TILE_COUNT];            // tile是否已经解码
+        
+        // 上次绘制背景之后写入过的数据
+        bool _nameTableDirty[NAME_TABLE_COUNT][NAME_TABLE_TILE_COUNT];
+        bool _nameTableAnyDirty[NAME_TABLE_COUNT];
+        bool _patternDirty[TILE_COUNT];
+        bool _patternAnyDirty[2];
     };
 }